@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <list>
+#include <mutex>
+#include <new>
+#include <string>
+
+#include "allocations.hpp"
+#include "logging.hpp"
+#include "metrics.hpp"
+#include "string.hpp"
+
+using namespace std;
+
+namespace dsmq {
+
+static Logger logger( "allocations" );
+
+static atomic< uint64_t > allocationCount {};
+static atomic< uint64_t > allocationBytes {};
+static thread_local uint64_t threadAllocationCount {};
+
+namespace {
+
+struct Sites
+{
+    list< AllocationBudget::Site > sites;
+    mutex access;
+};
+
+Sites& sites()
+{
+    static Sites instance;
+    return instance;
+}
+
+atomic< uint64_t > warmupRuns { 100 };
+
+} // namespace
+
+bool Allocations::enabled()
+{
+#if defined( DSMQ_COUNT_ALLOCATIONS )
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint64_t Allocations::count()
+{
+    return allocationCount.load( memory_order_relaxed );
+}
+
+uint64_t Allocations::bytes()
+{
+    return allocationBytes.load( memory_order_relaxed );
+}
+
+uint64_t Allocations::threadCount()
+{
+    return threadAllocationCount;
+}
+
+AllocationBudget::Site::Site( char const* name )
+        : name_ { name }
+        , exceeded_ { Metrics::counter( str( "heap.budget.", name, ".exceeded" )) } {}
+
+AllocationBudget::Scope::~Scope()
+{
+    auto limit = site_.limit_.load( memory_order_relaxed );
+    if ( limit < 0 || site_.runs_.fetch_add( 1, memory_order_relaxed ) < warmupRuns.load( memory_order_relaxed )) {
+        return;
+    }
+
+    auto allocations = Allocations::threadCount() - started_;
+    if ( allocations <= static_cast< uint64_t >( limit )) {
+        return;
+    }
+
+    site_.exceeded_.increment();
+
+    // log each new worst case only, a regression on a hot path would flood the log otherwise
+    auto worst = site_.worst_.load( memory_order_relaxed );
+    while ( allocations > worst ) {
+        if ( site_.worst_.compare_exchange_weak( worst, allocations, memory_order_relaxed )) {
+            logger.warning( "handler ", site_.name_, " made ", allocations, " heap allocations, budget is ", limit );
+            break;
+        }
+    }
+}
+
+AllocationBudget::Site& AllocationBudget::site( char const* name )
+{
+    auto& registry = sites();
+    lock_guard< mutex > lock { registry.access };
+    auto it = find_if( registry.sites.begin(), registry.sites.end(), [name]( auto const& site ) {
+        return string( site.name() ) == name;
+    } );
+    if ( it != registry.sites.end() ) {
+        return *it;
+    }
+    registry.sites.emplace_back( name );
+    return registry.sites.back();
+}
+
+bool AllocationBudget::limit( string const& name, int64_t limit )
+{
+    auto& registry = sites();
+    lock_guard< mutex > lock { registry.access };
+    auto it = find_if( registry.sites.begin(), registry.sites.end(), [&name]( auto const& site ) {
+        return site.name() == name;
+    } );
+    if ( it == registry.sites.end() ) {
+        return false;
+    }
+    it->limit_ = limit;
+    return true;
+}
+
+void AllocationBudget::warmup( uint64_t runs )
+{
+    warmupRuns = runs;
+}
+
+} // namespace dsmq
+
+#if defined( DSMQ_COUNT_ALLOCATIONS )
+
+static void* countedAllocate( size_t size ) noexcept
+{
+    dsmq::allocationCount.fetch_add( 1, memory_order_relaxed );
+    ++dsmq::threadAllocationCount;
+    dsmq::allocationBytes.fetch_add( size, memory_order_relaxed );
+    return malloc( size == 0 ? 1 : size );
+}
+
+static void* countedAllocateOrThrow( size_t size )
+{
+    while ( true ) {
+        if ( auto result = countedAllocate( size )) {
+            return result;
+        }
+        auto handler = get_new_handler();
+        if ( !handler ) {
+            throw bad_alloc();
+        }
+        handler();
+    }
+}
+
+void* operator new( size_t size ) { return countedAllocateOrThrow( size ); }
+void* operator new[]( size_t size ) { return countedAllocateOrThrow( size ); }
+void* operator new( size_t size, nothrow_t const& ) noexcept { return countedAllocate( size ); }
+void* operator new[]( size_t size, nothrow_t const& ) noexcept { return countedAllocate( size ); }
+
+void operator delete( void* ptr ) noexcept { free( ptr ); }
+void operator delete[]( void* ptr ) noexcept { free( ptr ); }
+void operator delete( void* ptr, size_t ) noexcept { free( ptr ); }
+void operator delete[]( void* ptr, size_t ) noexcept { free( ptr ); }
+void operator delete( void* ptr, nothrow_t const& ) noexcept { free( ptr ); }
+void operator delete[]( void* ptr, nothrow_t const& ) noexcept { free( ptr ); }
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef DS_MQTT_BRIDGE_ALLOCATIONS_HPP
+#define DS_MQTT_BRIDGE_ALLOCATIONS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace dsmq {
+
+/**
+ * class Allocations
+ *
+ * Process wide heap allocation counters. They only count when the bridge is built with DSMQ_COUNT_ALLOCATIONS, which
+ * replaces the global operator new.
+ */
+
+class Allocations
+{
+public:
+    static bool enabled();
+
+    static std::uint64_t count();
+    static std::uint64_t bytes();
+
+    // allocations made by the calling thread, so handlers on the io thread are not charged for the mosquitto thread
+    static std::uint64_t threadCount();
+};
+
+class Counter;
+
+/**
+ * class AllocationBudget
+ *
+ * Checks that a handler stays within a number of heap allocations per run once it is warmed up. Runs over budget
+ * count in "heap.budget.<site>.exceeded" and are logged. The allocation test holds the forwarding path to fixed budgets.
+ */
+
+class AllocationBudget
+{
+public:
+    class Site
+    {
+        friend class AllocationBudget;
+
+    public:
+        explicit Site( char const* name );
+
+        char const* name() const { return name_; }
+
+    private:
+        char const* name_;
+        Counter& exceeded_;
+        std::atomic< std::int64_t > limit_ { -1 };
+        std::atomic< std::uint64_t > runs_ {};
+        std::atomic< std::uint64_t > worst_ {};
+    };
+
+    class Scope
+    {
+    public:
+        explicit Scope( Site& site )
+                : site_ { site }
+                , started_ { Allocations::threadCount() } {}
+
+        Scope( Scope const& ) = delete;
+        ~Scope();
+
+    private:
+        Site& site_;
+        std::uint64_t started_;
+    };
+
+    // sites are registered once and live for the rest of the process, call sites keep the reference in a static
+    static Site& site( char const* name );
+
+    // a negative limit leaves the site unchecked, returns false if there is no such site
+    static bool limit( std::string const& name, std::int64_t limit );
+    static void warmup( std::uint64_t runs );
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_ALLOCATIONS_HPP
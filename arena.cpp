@@ -0,0 +1,56 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "arena.hpp"
+
+using namespace std;
+
+namespace dsmq {
+
+static size_t alignUp( size_t offset, size_t alignment )
+{
+    return ( offset + alignment - 1 ) & ~( alignment - 1 );
+}
+
+Arena::Arena( size_t capacity )
+{
+    blocks_.push_back( { make_unique< char[] >( capacity ), capacity } );
+}
+
+void* Arena::allocate( size_t size, size_t alignment )
+{
+    auto& current = blocks_.back();
+    auto base = reinterpret_cast< uintptr_t >( current.data.get() );
+    auto start = alignUp( base + offset_, alignment ) - base;
+    if ( start + size <= current.size ) {
+        offset_ = start + size;
+        return current.data.get() + start;
+    }
+
+    // new blocks come straight from new[], which is aligned for any fundamental type
+    auto blockSize = max( size, current.size * 2 );
+    blocks_.push_back( { make_unique< char[] >( blockSize ), blockSize } );
+    offset_ = size;
+    return blocks_.back().data.get();
+}
+
+void Arena::reset()
+{
+    if ( blocks_.size() > 1 ) {
+        auto total = capacity();
+        blocks_.clear();
+        blocks_.push_back( { make_unique< char[] >( total ), total } );
+    }
+    offset_ = 0;
+}
+
+size_t Arena::capacity() const
+{
+    size_t total {};
+    for ( auto const& block : blocks_ ) {
+        total += block.size;
+    }
+    return total;
+}
+
+} // namespace dsmq
@@ -0,0 +1,76 @@
+#ifndef DS_MQTT_BRIDGE_ARENA_HPP
+#define DS_MQTT_BRIDGE_ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dsmq {
+
+/**
+ * class Arena
+ *
+ * Monotonic allocator for data that lives exactly as long as one request. Deallocation is a no-op, reset() releases
+ * everything at once and folds the blocks that overflowed into one, so a steady workload stops touching the heap.
+ */
+
+class Arena
+{
+    struct Block
+    {
+        std::unique_ptr< char[] > data;
+        std::size_t size;
+    };
+
+public:
+    explicit Arena( std::size_t capacity = 4096 );
+    Arena( Arena const& ) = delete;
+
+    void* allocate( std::size_t size, std::size_t alignment );
+    void reset();
+
+    std::size_t capacity() const;
+
+private:
+    std::vector< Block > blocks_;
+    std::size_t offset_ {};
+};
+
+template< typename T >
+class ArenaAllocator
+{
+    template< typename U > friend class ArenaAllocator;
+
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator( Arena& arena ) noexcept
+            : arena_ { &arena } {}
+
+    template< typename U >
+    ArenaAllocator( ArenaAllocator< U > const& other ) noexcept
+            : arena_ { other.arena_ } {}
+
+    T* allocate( std::size_t count )
+    {
+        return static_cast< T* >( arena_->allocate( count * sizeof( T ), alignof( T )));
+    }
+
+    void deallocate( T*, std::size_t ) noexcept {}
+
+    template< typename U >
+    bool operator==( ArenaAllocator< U > const& other ) const noexcept { return arena_ == other.arena_; }
+
+    template< typename U >
+    bool operator!=( ArenaAllocator< U > const& other ) const noexcept { return arena_ != other.arena_; }
+
+private:
+    Arena* arena_;
+};
+
+using ArenaString = std::basic_string< char, std::char_traits< char >, ArenaAllocator< char > >;
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_ARENA_HPP
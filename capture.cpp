@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <utility>
+
+#include <boost/filesystem/operations.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <nlohmann/json.hpp>
+
+#include "capture.hpp"
+#include "logging.hpp"
+#include "string.hpp"
+
+using namespace std;
+using namespace std::experimental;
+using namespace nlohmann;
+
+namespace fs = boost::filesystem;
+namespace ipc = boost::interprocess;
+
+namespace dsmq {
+
+static Logger logger( "capture" );
+
+static constexpr size_t recordHeaderLength = 4 + 8 + 1 + 1 + 2;
+
+template< typename T >
+static char* putLittleEndian( char* dst, T value )
+{
+    for ( size_t i = 0; i < sizeof( T ); ++i ) {
+        *dst++ = static_cast< char >( ( value >> ( 8 * i )) & 0xff );
+    }
+    return dst;
+}
+
+static uint64_t captureTimestamp()
+{
+    return static_cast< uint64_t >( chrono::duration_cast< chrono::microseconds >(
+            chrono::system_clock::now().time_since_epoch()).count());
+}
+
+class Capture::Segment
+{
+public:
+    Segment( string const& fileName, size_t size, uint64_t timestamp, uint64_t sequence )
+            : size_ { size }
+    {
+        {
+            filebuf file;
+            if ( !file.open( fileName, ios::in | ios::out | ios::trunc | ios::binary )) {
+                throw system_error( errno, system_category(), "couldn't create " + fileName );
+            }
+            file.pubseekoff( size - 1, ios::beg );
+            file.sputc( 0 );
+        }
+
+        mapping_ = ipc::file_mapping { fileName.c_str(), ipc::read_write };
+        region_ = ipc::mapped_region { mapping_, ipc::read_write, 0, size };
+        data_ = static_cast< char* >( region_.get_address());
+
+        char* header = data_;
+        memcpy( header, "DSMQCAP", 8 );
+        header = putLittleEndian< uint32_t >( header + 8, version );
+        header = putLittleEndian< uint32_t >( header, headerLength );
+        header = putLittleEndian< uint64_t >( header, timestamp );
+        putLittleEndian< uint64_t >( header, sequence );
+        offset_ = headerLength;
+    }
+
+    ~Segment()
+    {
+        region_.flush();
+    }
+
+    bool fits( size_t length ) const
+    {
+        // keep room for the terminating zero length
+        return offset_ + length + 4 <= size_;
+    }
+
+    void append( uint64_t timestamp, Source source, string_view key, string_view payload )
+    {
+        char* dst = data_ + offset_;
+        dst = putLittleEndian< uint32_t >( dst, static_cast< uint32_t >( recordHeaderLength - 4 + key.size() + payload.size()));
+        dst = putLittleEndian< uint64_t >( dst, timestamp );
+        *dst++ = static_cast< char >( source );
+        *dst++ = 0;
+        dst = putLittleEndian< uint16_t >( dst, static_cast< uint16_t >( key.size()));
+        memcpy( dst, key.data(), key.size());
+        memcpy( dst + key.size(), payload.data(), payload.size());
+        offset_ += recordHeaderLength + key.size() + payload.size();
+    }
+
+private:
+    size_t size_;
+    ipc::file_mapping mapping_;
+    ipc::mapped_region region_;
+    char* data_ {};
+    size_t offset_ {};
+};
+
+Capture::Capture( json const& props )
+        : directory_ { props.at( "directory" ).get< string >() }
+        , segmentSize_ { props.value( "segmentSize", size_t { 4 } * 1024 * 1024 ) }
+        , segments_ { max< size_t >( props.value( "segments", size_t { 8 } ), 1 ) }
+{
+    if ( segmentSize_ <= headerLength + recordHeaderLength ) {
+        throw invalid_argument( str( "capture segment size ", segmentSize_, " is too small" ));
+    }
+
+    // a directory that can't be written to fails here, at startup, instead of on the first record
+    fs::create_directories( directory_ );
+    if ( !fs::is_directory( directory_ )) {
+        throw invalid_argument( str( "capture directory ", directory_, " is not a directory" ));
+    }
+
+    // the segments of earlier runs count towards the limit, names sort by time
+    for ( auto const& entry : fs::directory_iterator( directory_ )) {
+        auto name = entry.path().filename().string();
+        if ( name.compare( 0, 8, "capture-" ) == 0 && entry.path().extension() == ".dsmqcap" ) {
+            files_.push_back( entry.path().string() );
+        }
+    }
+    sort( files_.begin(), files_.end() );
+    prune( segments_ );
+
+    logger.info( "capturing traffic to ", directory_, " in ", segments_, " segments of ", segmentSize_, " bytes" );
+}
+
+Capture::~Capture() = default;
+
+void Capture::record( Source source, string_view key, string_view payload )
+{
+    if ( failed_ ) {
+        return;
+    }
+
+    auto length = recordHeaderLength + key.size() + payload.size();
+    if ( key.size() > 0xffff || headerLength + length + 4 > segmentSize_ ) {
+        logger.warning( "dropping capture record for ", key, " of ", length, " bytes" );
+        return;
+    }
+
+    auto timestamp = captureTimestamp();
+
+    lock_guard< mutex > lock { mutex_ };
+    try {
+        if ( !segment_ || !segment_->fits( length )) {
+            rotate( timestamp );
+        }
+        segment_->append( timestamp, source, key, payload );
+    } catch ( exception const& e ) {
+        // records come in on the clients' threads, where an exception would end the bridge
+        logger.error( "capture to ", directory_, " failed, capturing is disabled: ", e.what() );
+        segment_.reset();
+        failed_ = true;
+    }
+}
+
+void Capture::rotate( uint64_t timestamp )
+{
+    segment_.reset();
+
+    auto fileName = str( directory_, "/capture-", setfill( '0' ), setw( 16 ), timestamp, "-", setw( 6 ), sequence_, ".dsmqcap" );
+    logger.debug( "starting capture segment ", fileName );
+
+    // make room first so the disk never holds more than the configured segments
+    prune( segments_ - 1 );
+    files_.push_back( fileName );
+    segment_ = make_unique< Segment >( fileName, segmentSize_, timestamp, sequence_++ );
+}
+
+void Capture::prune( size_t keep )
+{
+    while ( files_.size() > keep ) {
+        boost::system::error_code ec;
+        fs::remove( files_.front(), ec );
+        if ( ec ) {
+            logger.warning( "couldn't remove capture segment ", files_.front(), ": ", ec.message() );
+        }
+        files_.pop_front();
+    }
+}
+
+} // namespace dsmq
@@ -0,0 +1,80 @@
+#ifndef DS_MQTT_BRIDGE_CAPTURE_HPP
+#define DS_MQTT_BRIDGE_CAPTURE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <experimental/string_view>
+
+#include <nlohmann/json_fwd.hpp>
+
+namespace dsmq {
+
+/**
+ * class Capture
+ *
+ * Appends received traffic to a series of memory mapped segment files. All integers are little endian.
+ *
+ * Segment header (32 bytes):
+ *   char[8]  magic "DSMQCAP\0"
+ *   uint32   format version
+ *   uint32   header length
+ *   uint64   timestamp of the first record (microseconds since epoch)
+ *   uint64   segment sequence number
+ *
+ * Record:
+ *   uint32   length of the record following this field, zero marks the end of the segment
+ *   uint64   timestamp (microseconds since epoch)
+ *   uint8    source (see Capture::Source)
+ *   uint8    reserved
+ *   uint16   length of the key
+ *   char[]   key (dSS event name or MQTT topic)
+ *   char[]   payload
+ *
+ * Segment files are named after the timestamp of their first record and their sequence number, so readers find
+ * the segment for a point in time by file name and scan forward from there. The directory is created if needed and
+ * holds at most the configured number of segments, those of earlier runs included. If writing fails, capturing stops
+ * with an error logged and the bridge carries on.
+ */
+
+class Capture
+{
+    class Segment;
+
+public:
+    enum class Source : std::uint8_t
+    {
+        dssEvent = 1,
+        mqttMessage = 2
+    };
+
+    static constexpr std::uint32_t version = 1;
+    static constexpr std::size_t headerLength = 32;
+
+    explicit Capture( nlohmann::json const& props );
+    Capture( Capture const& ) = delete;
+    ~Capture();
+
+    void record( Source source, std::experimental::string_view key, std::experimental::string_view payload );
+
+private:
+    void rotate( std::uint64_t timestamp );
+    void prune( std::size_t keep );
+
+    std::string directory_;
+    std::size_t segmentSize_;
+    std::size_t segments_;
+    std::uint64_t sequence_ {};
+    std::unique_ptr< Segment > segment_;
+    std::deque< std::string > files_;
+    std::mutex mutex_;
+    std::atomic< bool > failed_ {};
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_CAPTURE_HPP
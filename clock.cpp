@@ -0,0 +1,115 @@
+#include <atomic>
+#include <stdexcept>
+
+#include "clock.hpp"
+#include "logging.hpp"
+
+using namespace std;
+
+namespace asio = boost::asio;
+
+namespace dsmq {
+
+static Logger logger( "clock" );
+
+namespace {
+
+atomic< bool > virtualTime {};
+atomic< Clock::rep > virtualNow {};
+
+// earliest deadline the reactor asked about since the simulation last looked, max() if none
+atomic< Clock::rep > nextDeadline { Clock::duration::max().count() };
+
+void offerDeadline( Clock::rep deadline )
+{
+    auto next = nextDeadline.load( memory_order_relaxed );
+    while ( deadline < next && !nextDeadline.compare_exchange_weak( next, deadline, memory_order_relaxed )) {}
+}
+
+} // namespace
+
+Clock::time_point Clock::now()
+{
+    if ( virtualTime.load( memory_order_relaxed )) {
+        return time_point( duration( virtualNow.load( memory_order_relaxed )));
+    }
+    return time_point( chrono::steady_clock::now().time_since_epoch());
+}
+
+bool Clock::simulated()
+{
+    return virtualTime.load( memory_order_relaxed );
+}
+
+Clock::duration ClockTraits::to_wait_duration( Clock::duration const& duration )
+{
+    if ( !Clock::simulated()) {
+        return duration;
+    }
+    if ( duration > Clock::duration::zero()) {
+        offerDeadline( virtualNow.load( memory_order_relaxed ) + duration.count());
+    }
+    return Clock::duration::zero();
+}
+
+Clock::duration ClockTraits::to_wait_duration( Clock::time_point const& deadline )
+{
+    return to_wait_duration( deadline - Clock::now());
+}
+
+Simulation::Simulation( asio::io_context& context )
+        : context_ { context }
+{
+    if ( virtualTime.exchange( true )) {
+        throw logic_error( "another simulation is already running" );
+    }
+    virtualNow = chrono::steady_clock::now().time_since_epoch().count();
+    nextDeadline = Clock::duration::max().count();
+    logger.info( "running in virtual time" );
+}
+
+Simulation::~Simulation()
+{
+    virtualTime = false;
+}
+
+size_t Simulation::runUntil( Clock::time_point deadline )
+{
+    size_t result {};
+    bool idle {};
+    while ( Clock::now() < deadline ) {
+        nextDeadline = Clock::duration::max().count();
+        auto handlers = poll();
+        result += handlers;
+        if ( handlers > 0 ) {
+            idle = false;
+            continue;
+        }
+
+        auto next = nextDeadline.load();
+        if ( next == Clock::duration::max().count()) {
+            // give the reactor one more round to look at its timers before calling it a day
+            if ( idle ) {
+                break;
+            }
+            idle = true;
+            continue;
+        }
+        idle = false;
+        virtualNow = min( next, deadline.time_since_epoch().count());
+    }
+    return result + poll();
+}
+
+void Simulation::advance( Clock::duration duration )
+{
+    virtualNow += duration.count();
+}
+
+size_t Simulation::poll()
+{
+    context_.restart();
+    return context_.poll();
+}
+
+} // namespace dsmq
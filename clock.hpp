@@ -0,0 +1,78 @@
+#ifndef DS_MQTT_BRIDGE_CLOCK_HPP
+#define DS_MQTT_BRIDGE_CLOCK_HPP
+
+#include <chrono>
+#include <cstddef>
+
+#include <boost/asio/basic_waitable_timer.hpp>
+#include <boost/asio/io_context.hpp>
+
+namespace dsmq {
+
+/**
+ * class Clock
+ *
+ * The monotonic clock behind all of the bridge's timers. It follows std::chrono::steady_clock unless a Simulation
+ * has switched it to virtual time.
+ */
+
+class Clock
+{
+public:
+    using duration = std::chrono::steady_clock::duration;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point< Clock >;
+
+    static constexpr bool is_steady = true;
+
+    static time_point now();
+    static bool simulated();
+};
+
+/**
+ * struct ClockTraits
+ *
+ * Wait traits for timers on Clock. In virtual time the reactor never sleeps, the deadline it would have waited for is
+ * handed to the Simulation instead.
+ */
+
+struct ClockTraits
+{
+    static Clock::duration to_wait_duration( Clock::duration const& duration );
+    static Clock::duration to_wait_duration( Clock::time_point const& deadline );
+};
+
+using Timer = boost::asio::basic_waitable_timer< Clock, ClockTraits >;
+
+/**
+ * class Simulation
+ *
+ * Runs an io_context in virtual time. Ready handlers run as usual, whenever the loop would wait for a timer the clock
+ * jumps to its deadline, so hours of timer driven behaviour take as long as the handlers themselves. Only one
+ * simulation may exist at a time and the context must not be run by any other thread meanwhile.
+ */
+
+class Simulation
+{
+public:
+    explicit Simulation( boost::asio::io_context& context );
+    Simulation( Simulation const& ) = delete;
+    ~Simulation();
+
+    // runs until virtual time reaches the deadline or nothing is left to do, returns the number of handlers run
+    std::size_t runUntil( Clock::time_point deadline );
+    std::size_t runFor( Clock::duration duration ) { return runUntil( Clock::now() + duration ); }
+
+    // moves virtual time forward without running anything
+    void advance( Clock::duration duration );
+
+private:
+    std::size_t poll();
+
+    boost::asio::io_context& context_;
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_CLOCK_HPP
@@ -1,32 +1,48 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
 #include <chrono>
-#include <map>
+#include <deque>
+#include <memory>
 #include <sstream>
+#include <tuple>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 #include <experimental/optional>
 #include <experimental/string_view>
 
+#include <boost/asio/async_result.hpp>
 #include <boost/asio/connect.hpp>
+#include <boost/asio/coroutine.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/spawn.hpp>
 #include <boost/asio/ssl/context.hpp>
 #include <boost/asio/ssl/stream.hpp>
-#include <boost/asio/steady_timer.hpp>
-#include <boost/beast/core/buffers_to_string.hpp>
-#include <boost/beast/core/multi_buffer.hpp>
-#include <boost/beast/core/ostream.hpp>
-#include <boost/beast/http/dynamic_body.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
 #include <boost/beast/http/empty_body.hpp>
+#include <boost/beast/http/fields.hpp>
 #include <boost/beast/http/message.hpp>
 #include <boost/beast/http/read.hpp>
+#include <boost/beast/http/string_body.hpp>
 #include <boost/beast/http/write.hpp>
 #include <boost/beast/version.hpp>
 #include <nlohmann/json.hpp>
 
+#include "arena.hpp"
+#include "capture.hpp"
+#include "clock.hpp"
 #include "dss_client.hpp"
+#include "dss_health.hpp"
+#include "dss_scheduler.hpp"
 #include "error.hpp"
 #include "logging.hpp"
+#include "metrics.hpp"
+#include "profiler.hpp"
 #include "string.hpp"
+#include "timeline.hpp"
+#include "trace.hpp"
 
 using namespace std;
 using namespace std::experimental;
@@ -43,26 +59,701 @@ namespace dss {
 
 static Logger logger( "client_dss" );
 
+static bool isAuthError( string message )
+{
+    transform( message.begin(), message.end(), message.begin(), []( unsigned char c ) { return tolower( c ); } );
+    return message.find( "token" ) != string::npos
+            || message.find( "session" ) != string::npos
+            || message.find( "not logged in" ) != string::npos;
+}
+
+static constexpr chrono::milliseconds pollTimeout { 30000 };
+// how much longer than the poll timeout the dSS may take to answer an event/get
+static constexpr chrono::milliseconds pollGrace { 2000 };
+static constexpr size_t priorities = 3;
+
+static string const callSceneOp { "zone/callScene" };
+
+static Counter& requestsTimedOut = Metrics::counter( "dss.requests.timeout" );
+static Counter& commandsDropped = Metrics::counter( "dss.commands.dropped" );
+
+static Profiler::Site& processEventsSite = Profiler::site( "processEvents" );
+
+static constexpr chrono::seconds idleTimeout { 10 };
+static constexpr size_t maxIdleConnections = 4;
+
+using Fields = http::basic_fields< ArenaAllocator< char > >;
+// finds the objects of the events array in the raw text of an event/get response, {"ok":..,"result":{"events":[..]}},
+// leaves events empty if the text doesn't have that shape
+static void sliceEvents( string_view body, vector< string_view >& events )
+{
+    size_t depth {};
+    size_t eventsDepth {};
+    size_t start {};
+    bool eventsKey {};
+    for ( size_t i = 0; i < body.size(); ++i ) {
+        switch ( body[ i ] ) {
+            case '"': {
+                auto begin = ++i;
+                for ( ; i < body.size() && body[ i ] != '"'; ++i ) {
+                    if ( body[ i ] == '\\' ) {
+                        ++i;
+                    }
+                }
+                eventsKey = depth == 2 && eventsDepth == 0 && body.substr( begin, i - begin ) == "events";
+                continue;
+            }
+            case '{':
+            case '[':
+                if ( eventsKey && body[ i ] == '[' ) {
+                    eventsDepth = depth + 1;
+                } else if ( eventsDepth != 0 && depth == eventsDepth ) {
+                    start = i;
+                }
+                ++depth;
+                break;
+            case '}':
+            case ']':
+                if ( depth == 0 ) {
+                    events.clear();
+                    return;
+                }
+                --depth;
+                if ( eventsDepth != 0 && depth == eventsDepth && body[ i ] == '}' ) {
+                    events.push_back( body.substr( start, i + 1 - start ));
+                } else if ( eventsDepth != 0 && depth + 1 == eventsDepth ) {
+                    return;
+                }
+                break;
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+            case ':':
+                continue;
+        }
+        eventsKey = false;
+    }
+    events.clear();
+}
+
+using Body = http::basic_string_body< char, char_traits< char >, ArenaAllocator< char > >;
+
+class Connection
+{
+public:
+    Connection( asio::io_context& context, ssl::context& sslContext, Endpoint const& endpoint )
+            : endpoint_ { endpoint }
+            , stream_ { context, sslContext } {}
+
+    tcp::socket& socket() { return stream_.next_layer(); }
+
+    Arena& arena() { return arena_; }
+
+    bool expired() const { return expired_; }
+
+    // the last response allowed the connection to stay open
+    bool reusable() const { return reusable_ && !expired_; }
+
+    Clock::time_point idleSince() const { return idleSince_; }
+    void idle() { idleSince_ = Clock::now(); }
+
+    // how far the current exchange got before it failed
+    size_t written() const { return written_; }
+    size_t received() const { return received_; }
+
+    void expire()
+    {
+        // a stalled peer won't complete a TLS shutdown, so just drop the transport
+        expired_ = true;
+        boost::system::error_code ec;
+        socket().shutdown( tcp::socket::shutdown_both, ec );
+        socket().close( ec );
+    }
+
+    // the operations below take a yield context as well as a handler, the command workers resume with the latter
+    template< typename CompletionToken >
+    auto open( tcp::resolver::results_type const& resolved, CompletionToken&& token )
+    {
+        return asio::async_initiate< CompletionToken, void( boost::system::error_code ) >( [this, &resolved]( auto handler ) {
+            asio::async_connect( stream_.next_layer(), resolved, [this, handler = move( handler )]( boost::system::error_code ec, auto const& ) mutable {
+                if ( ec ) {
+                    handler( ec );
+                    return;
+                }
+                stream_.set_verify_mode( ssl::verify_none );
+                stream_.async_handshake( ssl::stream_base::client, move( handler ));
+            } );
+        }, token );
+    }
+
+    // starts a new exchange, everything allocated for the previous one is released
+    void begin()
+    {
+        request_ = nullopt;
+        response_ = nullopt;
+        arena_.reset();
+        reusable_ = false;
+        written_ = 0;
+        received_ = 0;
+    }
+
+    template< typename CompletionToken >
+    auto send( ArenaString const& target, bool keepAlive, CompletionToken&& token )
+    {
+        request_.emplace( piecewise_construct, make_tuple(), make_tuple( ArenaAllocator< char >( arena_ )));
+        request_->method( http::verb::get );
+        request_->target( boost::beast::string_view( target.data(), target.size() ));
+        request_->version( 11 );
+        request_->set( http::field::host, endpoint_.host() );
+        request_->set( http::field::user_agent, BOOST_BEAST_VERSION_STRING );
+        request_->keep_alive( keepAlive );
+        return asio::async_initiate< CompletionToken, void( boost::system::error_code ) >( [this]( auto handler ) {
+            http::async_write( stream_, *request_, [this, handler = move( handler )]( boost::system::error_code ec, size_t written ) mutable {
+                written_ = written;
+                handler( ec );
+            } );
+        }, token );
+    }
+
+    // reads the next response, result() then makes sense of it
+    template< typename CompletionToken >
+    auto read( CompletionToken&& token )
+    {
+        response_.emplace( piecewise_construct, make_tuple( ArenaAllocator< char >( arena_ )), make_tuple( ArenaAllocator< char >( arena_ )));
+        return asio::async_initiate< CompletionToken, void( boost::system::error_code ) >( [this]( auto handler ) {
+            http::async_read( stream_, buffer_, *response_, [this, handler = move( handler )]( boost::system::error_code ec, size_t received ) mutable {
+                received_ = received;
+                handler( ec );
+            } );
+        }, token );
+    }
+
+    // the raw body is copied to body if given
+    json receive( string const& op, asio::yield_context yield, string* rawBody = nullptr )
+    {
+        read( yield );
+        return result( op, rawBody );
+    }
+
+    json result( string const& op, string* rawBody = nullptr )
+    {
+        auto& response = *response_;
+        reusable_ = response.keep_alive();
+        if ( response.result() == http::status::unauthorized || response.result() == http::status::forbidden ) {
+            throw system_error( make_error_code( dsmq_errc::unauthorized ));
+        }
+        if ( response.result() != http::status::ok ) {
+            throw system_error( make_error_code( dsmq_errc::server_error ));
+        }
+
+        auto const& body = response.body();
+        logger.debug( endpoint_, "received response for ", op, ": ", string_view( body.data(), body.size() ));
+        if ( rawBody ) {
+            rawBody->assign( body.data(), body.size() );
+        }
+
+        // a body that isn't a dSS reply fails the request like a server error instead of escaping the event loop
+        auto message = json::parse( body.begin(), body.end(), nullptr, false );
+        auto ok = message.is_object() ? message.find( "ok" ) : message.end();
+        if ( ok == message.end() || !ok->is_boolean() ) {
+            throw system_error( make_error_code( dsmq_errc::server_error ), "malformed response" );
+        }
+        if ( !ok->get< bool >() ) {
+            auto text = message.value( "message", "" );
+            throw system_error( make_error_code( isAuthError( text ) ? dsmq_errc::unauthorized : dsmq_errc::not_ok ), text );
+        }
+        return message.count( "result" ) > 0 ? move( message.at( "result" ) ) : json( true );
+    }
+
+private:
+    Endpoint const& endpoint_;
+    ssl::stream< tcp::socket > stream_;
+    boost::beast::flat_buffer buffer_;
+    Arena arena_;
+    // live in the arena, so they go before it is reset
+    optional< http::request< http::empty_body, Fields >> request_;
+    optional< http::response< Body, Fields >> response_;
+    Clock::time_point idleSince_;
+    size_t written_ {};
+    size_t received_ {};
+    bool reusable_ {};
+    bool expired_ {};
+};
+
+/**
+ * class ConnectionPool
+ *
+ * Keeps a few idle keep-alive connections, and with them their buffers and arenas, for the next request.
+ */
+
+class ConnectionPool
+{
+public:
+    ConnectionPool( asio::io_context& context, ssl::context& sslContext, Endpoint const& endpoint )
+            : context_ { context }
+            , sslContext_ { sslContext }
+            , endpoint_ { endpoint }
+            , resolver_ { context } {}
+
+    // either an open connection from the pool or a new one that still has to be opened
+    shared_ptr< Connection > acquire()
+    {
+        auto now = Clock::now();
+        while ( !idle_.empty() ) {
+            auto connection = move( idle_.back() );
+            idle_.pop_back();
+            if ( connection->reusable() && now - connection->idleSince() < idleTimeout ) {
+                return connection;
+            }
+        }
+        return make_shared< Connection >( context_, sslContext_, endpoint_ );
+    }
+
+    template< typename CompletionToken >
+    auto open( Connection& connection, CompletionToken&& token )
+    {
+        return asio::async_initiate< CompletionToken, void( boost::system::error_code ) >( [this, &connection]( auto handler ) {
+            if ( resolved_ ) {
+                this->connect( connection, move( handler ));
+                return;
+            }
+            resolver_.async_resolve( endpoint_.host(), endpoint_.port(),
+                    [this, &connection, handler = move( handler )]( boost::system::error_code ec, tcp::resolver::results_type resolved ) mutable {
+                        if ( ec ) {
+                            handler( ec );
+                            return;
+                        }
+                        resolved_ = move( resolved );
+                        this->connect( connection, move( handler ));
+                    } );
+        }, token );
+    }
+
+    void release( shared_ptr< Connection > connection )
+    {
+        if ( connection->reusable() && idle_.size() < maxIdleConnections ) {
+            connection->idle();
+            idle_.push_back( move( connection ));
+        }
+    }
+
+private:
+    template< typename Handler >
+    void connect( Connection& connection, Handler handler )
+    {
+        connection.open( *resolved_, [this, handler = move( handler )]( boost::system::error_code ec ) mutable {
+            if ( ec ) {
+                // the address may have changed, resolve again next time
+                resolved_ = nullopt;
+            }
+            handler( ec );
+        } );
+    }
+
+    asio::io_context& context_;
+    ssl::context& sslContext_;
+    Endpoint const& endpoint_;
+    tcp::resolver resolver_;
+    optional< tcp::resolver::results_type > resolved_;
+    vector< shared_ptr< Connection >> idle_;
+};
+
+class EventDeduplicator
+{
+    struct Entry
+    {
+        array< size_t, 2 > seen;
+        Clock::time_point received;
+    };
+
+public:
+    explicit EventDeduplicator( chrono::milliseconds window )
+            : window_ { window } {}
+
+    // both pollers get every event, an occurrence is new as long as the poller reporting it is ahead of the other one,
+    // so the same event happening twice within the window still passes twice
+    bool accept( json const& event, size_t poller )
+    {
+        auto now = Clock::now();
+        while ( !expiry_.empty() && now - expiry_.front().first > window_ ) {
+            // an entry seen again since has a later record further back in the queue
+            auto it = recent_.find( expiry_.front().second );
+            if ( it != recent_.end() && it->second.received == expiry_.front().first ) {
+                recent_.erase( it );
+            }
+            expiry_.pop_front();
+        }
+
+        auto hash = hashEvent( event );
+        auto& entry = recent_[ hash ];
+        entry.received = now;
+        expiry_.emplace_back( now, hash );
+        auto& seen = entry.seen;
+        ++seen[ poller ];
+        return seen[ poller ] > seen[ 1 - poller ];
+    }
+
+private:
+    // walks name, properties and source instead of serializing the whole event
+    static size_t hashEvent( json const& event )
+    {
+        size_t result {};
+        auto combine = [&result]( size_t value ) { result ^= value + 0x9e3779b9 + ( result << 6 ) + ( result >> 2 ); };
+        auto combineObject = [&]( char const* key ) {
+            auto it = event.find( key );
+            if ( it == event.end() || !it->is_object() ) {
+                return;
+            }
+            for ( auto const& item : it->items() ) {
+                combine( std::hash< string >()( item.key() ));
+                auto const& value = item.value();
+                combine( value.is_string() ? std::hash< string >()( value.get_ref< string const& >() ) : std::hash< string >()( value.dump() ));
+            }
+        };
+        combine( std::hash< string >()( event.at( "name" ).get_ref< string const& >() ));
+        combineObject( "properties" );
+        combineObject( "source" );
+        return result;
+    }
+
+    chrono::milliseconds window_;
+    unordered_map< size_t, Entry > recent_;
+    deque< pair< Clock::time_point, size_t >> expiry_;
+};
+
+// a poller backing off sees the events the other one got only once it polls again, so their copies have to be
+// recognized for the longest backoff plus a whole poll
+static chrono::milliseconds deduplicationWindow( Options const& options )
+{
+    return max( options.deduplicationWindow(), options.backoff().maximum() + pollTimeout + pollGrace );
+}
+
 class Client::Impl
 {
 public:
-    Impl( asio::io_context& context, ssl::context& sslContext, Endpoint&& endpoint )
+    Impl( asio::io_context& context, ssl::context& sslContext, Endpoint&& endpoint, Options&& options, Capture* capture )
             : context_ { context }
             , sslContext_ { sslContext }
-            , endpoint_( move( endpoint ) ) {}
+            , endpoint_( move( endpoint ) )
+            , options_( move( options ) )
+            , capture_ { capture }
+            , pool_ { context_, sslContext_, endpoint_ }
+            , deduplicator_ { deduplicationWindow( options_ ) }
+            , scheduler_ { context_, options_.requestRate(), options_.requestBurst() }
+            , latencies_ { options_.deadlines() }
+            , breaker_ { options_.breaker() } {}
+
+    void subscribe( EventSubscriptions&& subscriptions )
+    {
+        subscriptions_.emplace( move( subscriptions ));
+    }
 
-    void subscribe( char const* name, function< void ( json const& event ) >&& handler )
+    void connect()
     {
-        eventHandlers_.emplace( name, move( handler ) );
+        startLogin();
+
+        logger.info( endpoint_, "running ", options_.workers(), " stackless command workers, the other coroutines with ",
+                options_.stackSize() > 0 ? str( options_.stackSize(), " byte" ) : string( "default" ), " stacks" );
+        workers_.reserve( options_.workers() );
+        for ( size_t i = 0; i < options_.workers(); ++i ) {
+            workers_.push_back( make_unique< CommandWorker >( *this ));
+            ( *workers_.back() )();
+        }
+
+        if ( options_.sessionRefresh() != chrono::milliseconds::zero() ) {
+            spawn( [this]( auto yield ) {
+                Timer timer { context_ };
+                while ( true ) {
+                    timer.expires_after( options_.sessionRefresh() );
+                    timer.async_wait( yield );
+                    this->keepSessionAlive( yield );
+                }
+            } );
+        }
     }
 
     void eventLoop()
     {
-        asio::spawn( [this]( auto yield ) {
+        spawnEventLoop( 0 );
+        if ( options_.overlappingPolls() ) {
+            logger.info( endpoint_, "keeping a second event/get in flight" );
+            spawnEventLoop( 1 );
+        }
+    }
+
+    void callScene( unsigned zone, unsigned group, unsigned scene, Priority priority )
+    {
+        if ( !breaker_.allow() ) {
+            holdCommand( zone, group, scene, priority );
+            return;
+        }
+
+        // a command waiting for the rate limit is just a queued handler, it only takes a worker once it may be sent
+        auto effective = priority == Priority::interactive && scheduler_.queued( zone ) > 0 ? Priority::automation : priority;
+        scheduler_.acquire( effective, zone, [this, effective, zone, group, scene] {
+            // workers pick commands by priority too, or an interactive one would queue behind earlier automation
+            commands_[ static_cast< size_t >( effective ) ].emplace_back( zone, group, scene );
+            commandReady_.cancel_one();
+        } );
+    }
+
+private:
+    template< typename Function >
+    void spawn( Function&& function )
+    {
+        auto attributes = options_.stackSize() > 0
+                ? boost::coroutines::attributes( options_.stackSize() )
+                : boost::coroutines::attributes();
+        asio::spawn( context_, forward< Function >( function ), attributes );
+    }
+
+    /**
+     * class CommandWorker
+     *
+     * Sends queued commands one after the other. A stackless coroutine, everything it keeps across a suspension is a
+     * member, so a worker costs this object instead of a stack. The workers are made once in connect() and reused for
+     * every command.
+     */
+
+    class CommandWorker : public asio::coroutine
+    {
+    public:
+        explicit CommandWorker( Impl& impl )
+                : impl_ { impl }
+                , timer_ { impl.context_ } {}
+
+        void operator()( boost::system::error_code ec = {} )
+        {
+            BOOST_ASIO_CORO_REENTER( this ) {
+                while ( true ) {
+                    while ( !impl_.nextCommand( command_ )) {
+                        BOOST_ASIO_CORO_YIELD impl_.commandReady_.async_wait( resume() );
+                    }
+                    query_ = str( "id=", get< 0 >( command_ ), "&groupID=", get< 1 >( command_ ), "&sceneNumber=", get< 2 >( command_ ));
+
+                    // a rejected token is replaced once, like request() does
+                    for ( attempt_ = 0; attempt_ < 2; ++attempt_ ) {
+                        if ( !impl_.token_ ) {
+                            impl_.startLogin();
+                            if ( impl_.loggingIn_ ) {
+                                BOOST_ASIO_CORO_YIELD impl_.loginDone_.async_wait( resume() );
+                            }
+                            if ( !impl_.token_ ) {
+                                logger.error( impl_.endpoint_, "system_error in callScene: login failed" );
+                                break;
+                            }
+                        }
+                        token_ = impl_.token_;
+
+                        do {
+                            start();
+                            // the wakeup that got here is no error of this attempt
+                            ec = {};
+                            if ( !reused_ ) {
+                                BOOST_ASIO_CORO_YIELD impl_.pool_.open( *connection_, resume() );
+                            }
+                            if ( !ec ) {
+                                connection_->begin();
+                                BOOST_ASIO_CORO_YIELD connection_->send( impl_.path( connection_->arena(), callSceneOp, query_ ), true, resume() );
+                            }
+                            if ( !ec ) {
+                                BOOST_ASIO_CORO_YIELD connection_->read( resume() );
+                            }
+                        } while ( retry( ec ));
+
+                        if ( !finish( ec )) {
+                            break;
+                        }
+                        impl_.invalidate( token_ );
+                    }
+                }
+            }
+        }
+
+    private:
+        // continues the coroutine where it suspended
+        struct Resume
+        {
+            template< typename... Args >
+            void operator()( boost::system::error_code ec, Args&&... ) const { ( *worker )( ec ); }
+
+            CommandWorker* worker;
+        };
+
+        Resume resume() { return { this }; }
+
+        // takes a connection and arms the deadline of the attempt
+        void start()
+        {
+            connection_ = impl_.pool_.acquire();
+            reused_ = connection_->reusable();
+#if defined( DSMQ_TRACEPOINTS )
+            id_ = ++impl_.requestId_;
+#endif
+            DSMQ_TRACE2( dss_request_start, id_, callSceneOp.c_str() );
+            deadline_ = impl_.latencies_.deadline( callSceneOp );
+            timer_.expires_after( deadline_ );
+            timer_.async_wait( [this, weak = weak_ptr< Connection >( connection_ )]( error_code ec ) {
+                if ( auto connection = weak.lock() ) {
+                    impl_.on_timeout( callSceneOp, *connection, ec );
+                }
+            } );
+            started_ = Clock::now();
+        }
+
+        // the rules of send() for a pooled connection the dSS closed as it was picked up, a command is never repeated
+        // once it may have been carried out
+        bool retry( boost::system::error_code const& ec )
+        {
+            timer_.cancel();
+            if ( ec && reused_ && !connection_->expired()
+                    && ( connection_->written() == 0 || ( connection_->received() == 0 && closed( ec )))) {
+                logger.debug( impl_.endpoint_, "pooled connection for ", callSceneOp, " was closed, retrying: ", ec.message() );
+                return true;
+            }
+            return false;
+        }
+
+        // true if the dSS rejected the token and there is an attempt left
+        bool finish( boost::system::error_code const& ec )
+        {
+            auto connection = move( connection_ );
+            if ( ec ) {
+                DSMQ_TRACE3( dss_request_end, id_, callSceneOp.c_str(), ec.value() );
+                impl_.failed( callSceneOp, connection->expired(), deadline_ );
+                if ( connection->expired() ) {
+                    logger.error( impl_.endpoint_, "system_error in callScene: ", callSceneOp, ": ", make_error_code( dsmq_errc::timeout ).message() );
+                } else {
+                    logger.error( impl_.endpoint_, "beast::system_error in callScene: ", ec.message() );
+                }
+                return false;
+            }
+
+            try {
+                connection->result( callSceneOp );
+                impl_.latencies_.record( callSceneOp, Clock::now() - started_ );
+                impl_.pool_.release( move( connection ));
+                impl_.succeeded();
+                DSMQ_TRACE3( dss_request_end, id_, callSceneOp.c_str(), 0 );
+                return false;
+            } catch ( system_error const& e ) {
+                DSMQ_TRACE3( dss_request_end, id_, callSceneOp.c_str(), e.code().value() );
+                // the dSS answered, so it is healthy even if it didn't like the request
+                if ( e.code() == make_error_code( dsmq_errc::not_ok ) || e.code() == make_error_code( dsmq_errc::unauthorized )) {
+                    impl_.pool_.release( move( connection ));
+                    impl_.succeeded();
+                    if ( e.code() == make_error_code( dsmq_errc::unauthorized ) && attempt_ == 0 ) {
+                        return true;
+                    }
+                } else {
+                    impl_.failed( callSceneOp, connection->expired(), deadline_ );
+                }
+                logger.error( impl_.endpoint_, "system_error in callScene: ", e.what() );
+                return false;
+            }
+        }
+
+        Impl& impl_;
+        tuple< unsigned, unsigned, unsigned > command_;
+        string query_;
+        size_t attempt_ {};
+        optional< string > token_;
+        shared_ptr< Connection > connection_;
+        bool reused_ {};
+        Timer timer_;
+        chrono::nanoseconds deadline_ {};
+        Clock::time_point started_;
+#if defined( DSMQ_TRACEPOINTS )
+        uint64_t id_ {};
+#endif
+    };
+
+    // takes the next command by priority
+    bool nextCommand( tuple< unsigned, unsigned, unsigned >& command )
+    {
+        auto queue = find_if( commands_.begin(), commands_.end(), []( auto const& q ) { return !q.empty(); } );
+        if ( queue == commands_.end() ) {
+            return false;
+        }
+        command = queue->front();
+        queue->pop_front();
+        return true;
+    }
+
+    // logs in unless there is a token or a login already under way, whoever needs the token waits for loginDone_
+    void startLogin()
+    {
+        if ( token_ || loggingIn_ ) {
+            return;
+        }
+        loggingIn_ = true;
+        loginDone_.expires_at( Clock::time_point::max() );
+        link_.enter( LinkState::State::loggingIn );
+        spawn( [this]( auto yield ) {
+            try {
+                scheduler_.acquire( Priority::housekeeping, 0, yield );
+                token_ = this->request( "system/loginApplication", str( "loginToken=", endpoint_.apikey() ), false, nullopt, yield )
+                        .at( "token" )
+                        .template get< string >();
+                ++session_;
+                StartupTimeline::mark( "dSS login complete" );
+            } catch ( system_error const& e ) {
+                logger.error( endpoint_, "system_error in login: ", e.what() );
+            } catch ( boost::beast::system_error const& e ) {
+                logger.error( endpoint_, "beast::system_error in login: ", e.what() );
+            } catch ( exception const& e ) {
+                logger.error( endpoint_, "unexpected error in login: ", e.what() );
+            }
+            if ( !token_ ) {
+                link_.enter( LinkState::State::disconnected );
+            }
+            loggingIn_ = false;
+            loginDone_.cancel();
+        } );
+    }
+
+    void invalidate( optional< string > const& token )
+    {
+        // a concurrent request may already have replaced the token that was rejected
+        if ( token_ && token_ == token ) {
+            logger.info( endpoint_, "session token was rejected, logging in again" );
+            token_ = nullopt;
+            startLogin();
+        }
+    }
+
+    void holdCommand( unsigned zone, unsigned group, unsigned scene, Priority priority )
+    {
+        if ( !options_.breaker().queueWhenOpen() || heldCommands_.size() >= options_.breaker().queueSize() ) {
+            logger.warning( endpoint_, "dSS is unhealthy, dropping callScene ", scene, " for zone ", zone, ", group ", group );
+            commandsDropped.increment();
+            return;
+        }
+
+        logger.info( endpoint_, "dSS is unhealthy, holding callScene ", scene, " for zone ", zone, ", group ", group );
+        DSMQ_TRACE3( dss_command_held, zone, group, scene );
+        heldCommands_.emplace_back( zone, group, scene, priority );
+    }
+
+    void flushHeldCommands()
+    {
+        auto commands = move( heldCommands_ );
+        heldCommands_.clear();
+        for ( auto const& command : commands ) {
+            callScene( get< 0 >( command ), get< 1 >( command ), get< 2 >( command ), get< 3 >( command ));
+        }
+    }
+
+    void spawnEventLoop( size_t poller )
+    {
+        spawn( [this, poller]( auto yield ) {
+            Backoff backoff { options_.backoff() };
+            Timer retry { context_ };
             do {
                 error_code ec;
                 try {
-                    this->eventLoop( yield );
+                    this->eventLoop( poller, backoff, yield );
                 } catch ( system_error const &e ) {
                     logger.error( endpoint_, "system_error in event loop: ", e.what());
                     ec = e.code();
@@ -71,123 +762,397 @@ public:
                         logger.error( endpoint_, "beast::system_error in event loop: ", e.what());
                     }
                     ec = e.code();
+                } catch ( exception const &e ) {
+                    logger.error( endpoint_, "unexpected error in event loop: ", e.what());
+                    ec = make_error_code( dsmq_errc::server_error );
                 }
-                if ( ec ) {
-                    token_ = nullopt;
+                if ( !ec ) {
+                    continue;
                 }
+                // a transport error or timeout leaves the subscriptions on the dSS in place and polling just resumes,
+                // a poll the dSS rejected means they are gone, so the first poller subscribes again
+                if ( ec == make_error_code( dsmq_errc::unauthorized ) || ec == make_error_code( dsmq_errc::not_ok )) {
+                    subscribedSession_ = 0;
+                }
+
+                // with a token the dSS is reachable but misbehaving, once it answers again polling resumes directly
+                link_.enter( token_ ? LinkState::State::degraded : LinkState::State::disconnected );
+                auto delay = backoff.next();
+                logger.info( endpoint_, "retrying event loop in ", delay.count(), " ms" );
+                retry.expires_after( delay );
+                boost::system::error_code waited;
+                retry.async_wait( yield[ waited ] );
             } while ( eventLoop_ );
         } );
     }
 
-    void callScene( unsigned zone, unsigned group, unsigned scene )
+    ArenaString path( Arena& arena, string const& op, string const& query ) const
+    {
+        ArenaString result { ArenaAllocator< char >( arena ) };
+        result.append( "/json/" ).append( op.data(), op.size() ).append( "?" ).append( query.data(), query.size() );
+        if ( token_ ) {
+            result.append( "&token=" ).append( token_->data(), token_->size() );
+        }
+        return result;
+    }
+
+    // a new session drops the subscriptions of the old one, so this only logs in when there is no valid token
+    void login( asio::yield_context yield )
     {
-        asio::spawn( [this, zone, group, scene]( auto yield ) {
+        if ( token_ ) {
+            return;
+        }
+        startLogin();
+        if ( loggingIn_ ) {
+            boost::system::error_code ec;
+            loginDone_.async_wait( yield[ ec ] );
+        }
+        if ( !token_ ) {
+            throw system_error( make_error_code( dsmq_errc::not_ok ), "login failed" );
+        }
+    }
+
+    // any request made with the token keeps its session from timing out on the dSS, an expired one is replaced by
+    // request() like for every other call
+    void keepSessionAlive( asio::yield_context yield )
+    {
+        if ( !token_ || loggingIn_ ) {
+            return;
+        }
+        logger.debug( endpoint_, "keeping session alive" );
+        try {
+            scheduler_.acquire( Priority::housekeeping, 0, yield );
+            request( "system/version", "", true, nullopt, yield );
+        } catch ( system_error const& e ) {
+            logger.warning( endpoint_, "couldn't keep session alive: ", e.what() );
+        } catch ( boost::beast::system_error const& e ) {
+            logger.warning( endpoint_, "couldn't keep session alive: ", e.what() );
+        }
+    }
+
+    json request( string const& op, string const& query, bool needsToken, optional< chrono::nanoseconds > timeout, asio::yield_context yield,
+            string* rawBody = nullptr )
+    {
+        if ( !needsToken ) {
+            return send( op, query, timeout, yield, rawBody );
+        }
+
+        login( yield );
+        auto token = token_;
+        try {
+            return send( op, query, timeout, yield, rawBody );
+        } catch ( system_error const& e ) {
+            if ( e.code() != make_error_code( dsmq_errc::unauthorized )) {
+                throw;
+            }
+        }
+
+        // only a rejected token invalidates the session, retry once with a fresh one
+        invalidate( token );
+        login( yield );
+        return send( op, query, timeout, yield, rawBody );
+    }
+
+    json send( string const& op, string const& query, optional< chrono::nanoseconds > timeout, asio::yield_context yield,
+            string* rawBody = nullptr )
+    {
+        logger.debug( endpoint_, "sending request ", op );
+
+        while ( true ) {
+            auto connection = pool_.acquire();
+            auto reused = connection->reusable();
+#if defined( DSMQ_TRACEPOINTS )
+            auto id = ++requestId_;
+#endif
+            DSMQ_TRACE2( dss_request_start, id, op.c_str() );
+
+            // long-polls have a fixed timeout, everything else gets a deadline from the observed latency
+            auto deadline = timeout ? *timeout : chrono::nanoseconds( latencies_.deadline( op ));
+            Timer timer { context_, deadline };
+            timer.async_wait( [this, &op, weak = weak_ptr< Connection >( connection )]( error_code ec ) {
+                if ( auto connection = weak.lock() ) {
+                    this->on_timeout( op, *connection, ec );
+                }
+            } );
+
+            auto started = Clock::now();
             try {
-                this->request( "zone/callScene", str( "id=", zone, "&groupID=", group, "&sceneNumber=", scene ), true, nullopt, yield );
+                if ( !reused ) {
+                    pool_.open( *connection, yield );
+                }
+                connection->begin();
+                connection->send( path( connection->arena(), op, query ), true, yield );
+                auto result = connection->receive( op, yield, rawBody );
+                if ( !timeout ) {
+                    latencies_.record( op, Clock::now() - started );
+                }
+                pool_.release( move( connection ));
+                succeeded();
+                DSMQ_TRACE3( dss_request_end, id, op.c_str(), 0 );
+                return result;
             } catch ( system_error const& e ) {
-                logger.error( endpoint_, "system_error in callScene: ", e.what() );
+                DSMQ_TRACE3( dss_request_end, id, op.c_str(), e.code().value() );
+                // the dSS answered, so it is healthy even if it didn't like the request
+                if ( e.code() == make_error_code( dsmq_errc::not_ok ) || e.code() == make_error_code( dsmq_errc::unauthorized )) {
+                    pool_.release( move( connection ));
+                    succeeded();
+                    throw;
+                }
+                failed( op, connection->expired(), deadline );
+                if ( connection->expired() ) {
+                    throw system_error( make_error_code( dsmq_errc::timeout ), op );
+                }
+                throw;
             } catch ( boost::beast::system_error const& e ) {
-                logger.error( endpoint_, "beast::system_error in callScene: ", e.what() );
+                DSMQ_TRACE3( dss_request_end, id, op.c_str(), e.code().value() );
+                // the dSS may have closed an idle connection just as it was picked up, that's no failure as long as the
+                // request can't have been carried out: it wasn't written, or the connection was closed without a
+                // byte of response; anything else may already have happened and is only repeated if that's harmless
+                if ( reused && !connection->expired()
+                        && ( connection->written() == 0 || ( connection->received() == 0 && closed( e.code() )) || idempotent( op ))) {
+                    logger.debug( endpoint_, "pooled connection for ", op, " was closed, retrying: ", e.what() );
+                    continue;
+                }
+                failed( op, connection->expired(), deadline );
+                if ( connection->expired() ) {
+                    throw system_error( make_error_code( dsmq_errc::timeout ), op );
+                }
+                throw;
             }
-        } );
+        }
     }
 
-private:
-    string path( string const& op, string const& query ) const
+    static bool closed( boost::system::error_code const& ec )
     {
-        return str( "/json/", op, "?", query, token_ ? "&token=" : "", token_ ? *token_ : "" );
+        return ec == http::error::end_of_stream || ec == asio::error::eof || ec == asio::error::connection_reset
+                || ec == ssl::error::stream_truncated;
     }
 
-    json request( string const& op, string const& query, bool needsToken, optional< chrono::nanoseconds > timeout, asio::yield_context yield )
+    // requests that only read or set state, so sending them twice does no harm
+    static bool idempotent( string const& op )
     {
-        if ( needsToken && !token_ ) {
-            token_ = request( "system/loginApplication", str( "loginToken=", endpoint_.apikey() ), false, nullopt, yield )
-                    .at( "token" )
-                    .get< string >();
-        }
+        return op == "system/version" || op == "event/subscribe";
+    }
 
-        logger.debug( endpoint_, "sending request ", op );
+    void succeeded()
+    {
+        if ( breaker_.success() ) {
+            flushHeldCommands();
+        }
+    }
 
-        tcp::resolver resolver { context_ };
-        auto resolved { resolver.async_resolve( endpoint_.host(), endpoint_.port(), yield ) };
+    // a request that ran into its deadline also counts against the latency estimate
+    void failed( string const& op, bool timedOut, chrono::nanoseconds deadline )
+    {
+        breaker_.failure();
+        if ( timedOut ) {
+            requestsTimedOut.increment();
+            latencies_.record( op, deadline );
+        }
+    }
 
-        ssl::stream< tcp::socket > stream { context_, sslContext_ };
+    size_t subscribeEvents( asio::yield_context yield )
+    {
+        login( yield );
+        auto session = session_;
+        link_.enter( LinkState::State::subscribing );
 
-        asio::steady_timer timer { context_ };
-        if ( timeout ) {
-            timer.expires_after( *timeout );
-            timer.async_wait( [this, &op, &socket = stream.next_layer()]( error_code ec ) { this->on_timeout( op, socket, ec ); } );
+        // each poller drains a subscription of its own, the dSS hands every event to each of them
+        vector< string > queries;
+        for ( size_t poller = 0; poller < pollers(); ++poller ) {
+            for ( size_t i = 0; i < subscriptions_->size(); ++i ) {
+                if ( subscriptions_->subscribes( i )) {
+                    queries.push_back( str( "subscriptionID=", subscriptionId( poller ), "&name=", subscriptions_->name( i )));
+                }
+            }
+        }
+        if ( queries.empty() ) {
+            return session;
         }
 
-        asio::async_connect( stream.next_layer(), resolved, yield );
-        stream.set_verify_mode( ssl::verify_none );
-        stream.async_handshake( ssl::stream_base::client, yield );
+        logger.debug( endpoint_, "sending ", queries.size(), " pipelined requests event/subscribe" );
 
-        http::request< http::empty_body > request { http::verb::get, path( op, query ), 11 };
-        request.set( http::field::host, endpoint_.host() );
-        request.set( http::field::user_agent, BOOST_BEAST_VERSION_STRING );
-        http::async_write( stream, request, yield );
+        // all subscriptions go out on one connection before the first response is read
+        try {
+            auto connection = pool_.acquire();
+            Timer timer { context_, options_.deadlines().maximum() };
+            timer.async_wait( [this, weak = weak_ptr< Connection >( connection )]( error_code ec ) {
+                if ( auto connection = weak.lock() ) {
+                    this->on_timeout( "event/subscribe", *connection, ec );
+                }
+            } );
 
-        boost::beast::multi_buffer buffer;
-        http::response< http::dynamic_body > response;
-        http::async_read( stream, buffer, response, yield );
-        if ( response.result() != http::status::ok ) {
-            throw system_error( make_error_code( dsmq_errc::server_error ));
+            if ( !connection->reusable() ) {
+                pool_.open( *connection, yield );
+            }
+            connection->begin();
+            for ( auto const& query : queries ) {
+                scheduler_.acquire( Priority::housekeeping, 0, yield );
+                connection->send( path( connection->arena(), "event/subscribe", query ), true, yield );
+            }
+            for ( size_t i = 0; i < queries.size(); ++i ) {
+                connection->receive( "event/subscribe", yield );
+            }
+            pool_.release( move( connection ));
+            succeeded();
+            return session;
+        } catch ( system_error const& e ) {
+            if ( e.code() == make_error_code( dsmq_errc::unauthorized )) {
+                throw;
+            }
+            logger.warning( endpoint_, "pipelined event/subscribe failed, subscribing one by one: ", e.what() );
+        } catch ( boost::beast::system_error const& e ) {
+            logger.warning( endpoint_, "pipelined event/subscribe failed, subscribing one by one: ", e.what() );
         }
 
-        logger.debug( endpoint_, "received response for ", op, ": ", boost::beast::buffers( response.body().data()));
-
-        auto message = json::parse( boost::beast::buffers_to_string( response.body().data()));
-        if ( !message.at( "ok" )) {
-            throw system_error( make_error_code( dsmq_errc::not_ok ), message.at( "message" ));
+        for ( auto const& query : queries ) {
+            scheduler_.acquire( Priority::housekeeping, 0, yield );
+            request( "event/subscribe", query, true, nullopt, yield );
         }
-        return message.count( "result" ) > 0 ? move( message.at( "result" ) ) : json( true );
+        return session;
     }
 
-    void processEvents( json const& events )
+    // the raw events are the slices of the response each event was parsed from, recorded as received if capturing
+    void processEvents( json const& events, vector< string_view > const& rawEvents, size_t poller )
     {
+        Profiler::Scope scope { processEventsSite };
+        if ( !events.is_array() ) {
+            logger.warning( endpoint_, "skipping event/get result without events: ", events.dump() );
+            return;
+        }
+        auto raw = rawEvents.size() == events.size() ? rawEvents.begin() : rawEvents.end();
         for ( auto const& event : events ) {
-            auto range = eventHandlers_.equal_range( event.at( "name" ).get< string >() );
-            for_each( range.first, range.second, [&]( auto const& eventHandler ) { eventHandler.second( event ); } );
+            auto rawEvent = raw != rawEvents.end() ? *raw++ : string_view();
+            // malformed events are skipped one by one, the subscriptions log the ones that can't be decoded
+            auto name = event.is_object() ? event.find( "name" ) : event.end();
+            if ( name == event.end() || !name->is_string() ) {
+                logger.warning( endpoint_, "skipping event without a name: ", event.dump() );
+                continue;
+            }
+            if ( options_.overlappingPolls() && !deduplicator_.accept( event, poller )) {
+                logger.debug( endpoint_, "dropping event already delivered to the other poller" );
+                continue;
+            }
+
+            DSMQ_TRACE1( dss_event_receive, name->get_ref< string const& >().c_str() );
+            if ( capture_ ) {
+                auto const& key = name->get_ref< string const& >();
+                if ( !rawEvent.empty() ) {
+                    capture_->record( Capture::Source::dssEvent, key, rawEvent );
+                } else {
+                    capture_->record( Capture::Source::dssEvent, key, event.dump() );
+                }
+            }
+            subscriptions_->dispatch( event );
+            DSMQ_TRACE1( dss_event_decode, name->get_ref< string const& >().c_str() );
         }
     }
 
-    void eventLoop( asio::yield_context yield )
+    void eventLoop( size_t poller, Backoff& backoff, asio::yield_context yield )
     {
         eventLoop_ = true;
-        for ( auto const& eventHandler : eventHandlers_ ) {
-            request( "event/subscribe", str( "subscriptionID=1&name=", eventHandler.first ), true, nullopt, yield );
+        Timer timer { context_ };
+        if ( poller != 0 ) {
+            // wait for the first poller's subscriptions, then start half a poll period behind it so both pollers
+            // never time out together
+            awaitSubscriptions( timer, yield );
+            timer.expires_after( pollTimeout / 2 );
+            timer.async_wait( yield );
         }
+
+        // built once, the poll is the one request that runs all the time
+        string const op { "event/get" };
+        auto const query = str( "subscriptionID=", subscriptionId( poller ), "&timeout=", pollTimeout.count() );
+        string rawBody;
+        vector< string_view > rawEvents;
         while ( eventLoop_ ) {
-            processEvents( request( "event/get", "subscriptionID=1&timeout=30000", true, chrono::seconds( 32 ), yield ).at( "events" ));
+            // subscriptions belong to the session, so a new login means subscribing again
+            if ( poller == 0 && subscribedSession_ != session_ ) {
+                subscribedSession_ = subscribeEvents( yield );
+                StartupTimeline::mark( "dSS events subscribed" );
+            } else if ( poller != 0 ) {
+                // after a new login the subscription of this poller only exists once the first poller has renewed it
+                awaitSubscriptions( timer, yield );
+            }
+            auto events = request( op, query, true, pollTimeout + pollGrace, yield, capture_ ? &rawBody : nullptr );
+            link_.enter( LinkState::State::polling );
+            backoff.reset();
+            auto found = events.find( "events" );
+            rawEvents.clear();
+            if ( capture_ ) {
+                sliceEvents( rawBody, rawEvents );
+            }
+            processEvents( found != events.end() ? *found : json(), rawEvents, poller );
         }
     }
 
-    void on_timeout( string const& op, tcp::socket& socket, error_code ec ) const
+    void awaitSubscriptions( Timer& timer, asio::yield_context yield )
+    {
+        while ( subscribedSession_ == 0 || subscribedSession_ != session_ ) {
+            timer.expires_after( chrono::milliseconds( 100 ));
+            timer.async_wait( yield );
+        }
+    }
+
+    size_t pollers() const
+    {
+        return options_.overlappingPolls() ? 2 : 1;
+    }
+
+    static size_t subscriptionId( size_t poller )
+    {
+        return poller + 1;
+    }
+
+    void on_timeout( string const& op, Connection& connection, error_code ec ) const
     {
         if ( ec == make_error_code( asio::error::operation_aborted )) {
             return;
         }
-        logger.error( endpoint_, "timeout waiting for response for ", op, ", cancelling request" );
-        socket.cancel();
+        logger.error( endpoint_, "timeout waiting for response for ", op, ", closing connection" );
+        connection.expire();
     }
 
     asio::io_context& context_;
     ssl::context& sslContext_;
     Endpoint endpoint_;
+    Options options_;
+    Capture* capture_;
+    ConnectionPool pool_;
+    EventDeduplicator deduplicator_;
+    RequestScheduler scheduler_;
+    LatencyEstimator latencies_;
+    CircuitBreaker breaker_;
+    LinkState link_;
+    deque< tuple< unsigned, unsigned, unsigned, Priority > > heldCommands_;
+    array< deque< tuple< unsigned, unsigned, unsigned > >, priorities > commands_;
+    Timer commandReady_ { context_, Clock::time_point::max() };
     optional< string > token_;
-    multimap< string_view, function< void ( json const& event ) > > eventHandlers_;
+    bool loggingIn_ {};
+    Timer loginDone_ { context_ };
+    optional< EventSubscriptions > subscriptions_;
     bool eventLoop_ {};
+    size_t session_ {};
+    size_t subscribedSession_ {};
+#if defined( DSMQ_TRACEPOINTS )
+    uint64_t requestId_ {};
+#endif
+    vector< unique_ptr< CommandWorker >> workers_;
 };
 
-Client::Client( asio::io_context& context, ssl::context& sslContext, Endpoint endpoint )
-        : impl_ { make_unique< Impl >( context, sslContext, move( endpoint ) ) } {}
+Client::Client( asio::io_context& context, ssl::context& sslContext, Endpoint endpoint, Options options, Capture* capture )
+        : impl_ { make_unique< Impl >( context, sslContext, move( endpoint ), move( options ), capture ) } {}
 
 Client::~Client() = default;
 
-void Client::subscribe( char const* name, std::function< void( nlohmann::json const& event ) >&& handler )
+void Client::subscribe( EventSubscriptions subscriptions )
+{
+    impl_->subscribe( move( subscriptions ));
+}
+
+void Client::connect()
 {
-    impl_->subscribe( name, move( handler ) );
+    impl_->connect();
 }
 
 void Client::eventLoop()
@@ -195,9 +1160,9 @@ void Client::eventLoop()
     impl_->eventLoop();
 }
 
-void Client::callScene( unsigned zone, unsigned group, unsigned scene )
+void Client::callScene( unsigned zone, unsigned group, unsigned scene, Priority priority )
 {
-    impl_->callScene( zone, group, scene );
+    impl_->callScene( zone, group, scene, priority );
 }
 
 } // namespace dss
@@ -1,19 +1,20 @@
 #ifndef DS_MQTT_BRIDGE_DSS_CLIENT_HPP
 #define DS_MQTT_BRIDGE_DSS_CLIENT_HPP
 
-#include <functional>
 #include <memory>
 #include <string>
 
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ssl/context.hpp>
 #include <boost/asio/spawn.hpp>
-#include <boost/utility/string_view_fwd.hpp>
-#include <nlohmann/json_fwd.hpp>
 
+#include "dss_events.hpp"
 #include "dss_types.hpp"
 
 namespace dsmq {
+
+class Capture;
+
 namespace dss {
 
 class Client
@@ -21,22 +22,18 @@ class Client
     class Impl;
 
 public:
-    Client( boost::asio::io_context& context, boost::asio::ssl::context& sslContext, Endpoint endpoint );
+    Client( boost::asio::io_context& context, boost::asio::ssl::context& sslContext, Endpoint endpoint, Options options,
+            Capture* capture );
     ~Client();
 
-    template< typename Event >
-    void subscribe( std::function< void ( Event event ) > handler )
-    {
-        subscribe( Event::name, move( handler ) );
-    }
+    void subscribe( EventSubscriptions subscriptions );
 
+    void connect();
     void eventLoop();
 
-    void callScene( unsigned zone, unsigned group, unsigned scene );
+    void callScene( unsigned zone, unsigned group, unsigned scene, Priority priority = Priority::interactive );
 
 private:
-    void subscribe( char const* name, std::function< void ( nlohmann::json const& event ) >&& handler );
-
     std::unique_ptr< Impl > impl_;
 };
 
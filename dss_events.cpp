@@ -0,0 +1,40 @@
+#include <exception>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "dss_events.hpp"
+#include "logging.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace dsmq {
+namespace dss {
+
+static Logger logger( "dss_events" );
+
+bool EventSubscriptions::dispatch( json const& event ) const
+{
+    auto name = event.find( "name" );
+    if ( name == event.end() || !name->is_string() ) {
+        logger.warning( "skipping event without a name: ", event.dump() );
+        return false;
+    }
+
+    for ( size_t i = 0; i < table_.size(); ++i ) {
+        if ( table_[ i ] && name->get_ref< string const& >() == names_[ i ] ) {
+            try {
+                table_[ i ]( handler_, event );
+                return true;
+            } catch ( exception const& e ) {
+                logger.warning( "skipping malformed ", names_[ i ], " event: ", e.what(), ": ", event.dump() );
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+} // namespace dss
+} // namespace dsmq
@@ -0,0 +1,121 @@
+#ifndef DS_MQTT_BRIDGE_DSS_EVENTS_HPP
+#define DS_MQTT_BRIDGE_DSS_EVENTS_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json_fwd.hpp>
+
+#include "dss_types.hpp"
+
+namespace dsmq {
+namespace dss {
+
+using EventDispatch = void ( * )( void* handler, nlohmann::json const& event );
+
+template< typename ...Events >
+struct EventList {};
+
+/**
+ * All events the client knows how to decode
+ */
+
+using KnownEvents = EventList< EventCallScene, EventUndoScene, EventDeviceSensorValue, EventZoneSensorValue, EventStateChange >;
+
+namespace detail {
+
+template< typename Handler, typename Event, typename = void >
+struct HandlesEvent : std::false_type {};
+
+template< typename Handler, typename Event >
+struct HandlesEvent< Handler, Event, decltype( std::declval< Handler& >().on_event( std::declval< Event >() ), void() ) >
+        : std::true_type {};
+
+} // namespace detail
+
+/**
+ * class EventDispatcher
+ *
+ * Compile time table mapping each known event name to a function that decodes the event into its type and passes it
+ * to Handler::on_event(). Events the handler has no overload for get a null entry and are not subscribed to.
+ */
+
+template< typename Handler, typename List = KnownEvents >
+class EventDispatcher;
+
+template< typename Handler, typename ...Events >
+class EventDispatcher< Handler, EventList< Events... > >
+{
+    template< typename Event >
+    static void dispatch( void* handler, nlohmann::json const& event )
+    {
+        Event decoded;
+        from_json( event, decoded );
+        static_cast< Handler* >( handler )->on_event( std::move( decoded ));
+    }
+
+    template< typename Event >
+    static constexpr EventDispatch entry( std::true_type ) { return &dispatch< Event >; }
+
+    template< typename Event >
+    static constexpr EventDispatch entry( std::false_type ) { return nullptr; }
+
+public:
+    static constexpr std::size_t size = sizeof...( Events );
+    static constexpr char const* names[] = { Events::name... };
+    static constexpr EventDispatch table[] = { entry< Events >( detail::HandlesEvent< Handler, Events > {} )... };
+};
+
+template< typename Handler, typename ...Events >
+constexpr char const* EventDispatcher< Handler, EventList< Events... > >::names[];
+
+template< typename Handler, typename ...Events >
+constexpr EventDispatch EventDispatcher< Handler, EventList< Events... > >::table[];
+
+/**
+ * class EventSubscriptions
+ *
+ * The events a handler is subscribed to, starting from what its EventDispatcher can decode. Events the configuration
+ * has no use for can be disabled at runtime, they are then neither subscribed to on the dSS nor dispatched.
+ */
+
+class EventSubscriptions
+{
+public:
+    template< typename Handler >
+    explicit EventSubscriptions( Handler& handler )
+            : handler_ { &handler }
+            , names_ { EventDispatcher< Handler >::names }
+            , table_ { std::begin( EventDispatcher< Handler >::table ), std::end( EventDispatcher< Handler >::table ) } {}
+
+    void disable( char const* name )
+    {
+        for ( std::size_t i = 0; i < table_.size(); ++i ) {
+            if ( std::strcmp( names_[ i ], name ) == 0 ) {
+                table_[ i ] = nullptr;
+            }
+        }
+    }
+
+    std::size_t size() const { return table_.size(); }
+    char const* name( std::size_t i ) const { return names_[ i ]; }
+    bool subscribes( std::size_t i ) const { return table_[ i ] != nullptr; }
+
+    // passes the event to the handler, returns false if it isn't subscribed to or couldn't be decoded; a malformed
+    // event is logged and skipped so the ones after it still get through
+    bool dispatch( nlohmann::json const& event ) const;
+
+private:
+    void* handler_;
+    char const* const* names_;
+    std::vector< EventDispatch > table_;
+};
+
+} // namespace dss
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_DSS_EVENTS_HPP
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cmath>
+
+#include "dss_health.hpp"
+#include "logging.hpp"
+#include "metrics.hpp"
+#include "string.hpp"
+#include "trace.hpp"
+
+using namespace std;
+
+namespace dsmq {
+namespace dss {
+
+static Logger logger( "dss_health" );
+
+static Counter& breakerOpened = Metrics::counter( "dss.breaker.opened" );
+
+LatencyEstimator::LatencyEstimator( DeadlineOptions const& options )
+        : options_ { options } {}
+
+void LatencyEstimator::record( string const& op, chrono::nanoseconds latency )
+{
+    auto sample = chrono::duration< double, milli >( latency ).count();
+
+    auto it = estimates_.find( op );
+    if ( it == estimates_.end() ) {
+        estimates_.emplace( op, Estimate { sample, sample / 2 } );
+        return;
+    }
+
+    auto& estimate = it->second;
+    estimate.deviation += 0.25 * ( abs( sample - estimate.mean ) - estimate.deviation );
+    estimate.mean += 0.125 * ( sample - estimate.mean );
+}
+
+chrono::milliseconds LatencyEstimator::deadline( string const& op ) const
+{
+    auto it = estimates_.find( op );
+    if ( it == estimates_.end() ) {
+        return options_.initial();
+    }
+
+    auto deadline = chrono::milliseconds( static_cast< long >( it->second.mean + options_.multiplier() * it->second.deviation ));
+    return min( max( deadline, options_.minimum() ), options_.maximum() );
+}
+
+CircuitBreaker::CircuitBreaker( BreakerOptions const& options )
+        : options_ { options } {}
+
+bool CircuitBreaker::allow()
+{
+    switch ( state_ ) {
+        case State::closed:
+            return true;
+
+        case State::open:
+            if ( Clock::now() < retryAt_ ) {
+                return false;
+            }
+            logger.info( "cooldown elapsed, letting a trial request through" );
+            state_ = State::halfOpen;
+            return true;
+
+        case State::halfOpen:
+            return false;
+    }
+    return false;
+}
+
+bool CircuitBreaker::success()
+{
+    failures_ = 0;
+    if ( state_ == State::closed ) {
+        return false;
+    }
+
+    logger.info( "dSS is healthy again, closing circuit breaker" );
+    state_ = State::closed;
+    return true;
+}
+
+Backoff::Backoff( BackoffOptions const& options )
+        : options_ { options }
+        , random_ { random_device()() } {}
+
+chrono::milliseconds Backoff::next()
+{
+    current_ = current_ == chrono::milliseconds::zero()
+            ? options_.initial()
+            : min( chrono::duration_cast< chrono::milliseconds >( current_ * options_.multiplier() ), options_.maximum() );
+
+    auto half = current_.count() / 2;
+    return chrono::milliseconds( half + uniform_int_distribution< chrono::milliseconds::rep >( 0, current_.count() - half )( random_ ));
+}
+
+void Backoff::reset()
+{
+    current_ = chrono::milliseconds::zero();
+}
+
+static char const* const stateNames[] = { "disconnected", "loggingIn", "subscribing", "polling", "degraded" };
+
+LinkState::LinkState()
+{
+    for ( size_t i = 0; i < states; ++i ) {
+        transitions_[ i ] = &Metrics::counter( str( "dss.state.", stateNames[ i ] ));
+    }
+}
+
+void LinkState::enter( State state )
+{
+    if ( state == state_ ) {
+        return;
+    }
+
+    logger.info( "dSS link ", stateNames[ static_cast< size_t >( state_ ) ], " -> ", stateNames[ static_cast< size_t >( state ) ] );
+    state_ = state;
+    DSMQ_TRACE1( dss_state, static_cast< int >( state ));
+    transitions_[ static_cast< size_t >( state ) ]->increment();
+}
+
+void CircuitBreaker::failure()
+{
+    if ( state_ == State::open || ( state_ == State::closed && ++failures_ < options_.threshold() )) {
+        return;
+    }
+
+    logger.warning( "dSS is unhealthy, opening circuit breaker for ", options_.cooldown().count(), " ms" );
+    state_ = State::open;
+    retryAt_ = Clock::now() + options_.cooldown();
+    breakerOpened.increment();
+}
+
+} // namespace dss
+} // namespace dsmq
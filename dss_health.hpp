@@ -0,0 +1,134 @@
+#ifndef DS_MQTT_BRIDGE_DSS_HEALTH_HPP
+#define DS_MQTT_BRIDGE_DSS_HEALTH_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "clock.hpp"
+#include "dss_types.hpp"
+
+namespace dsmq {
+
+class Counter;
+
+namespace dss {
+
+/**
+ * class LatencyEstimator
+ *
+ * Smoothed latency and deviation per operation, deadlines are the smoothed latency plus a multiple of the deviation.
+ */
+
+class LatencyEstimator
+{
+    struct Estimate
+    {
+        double mean;
+        double deviation;
+    };
+
+public:
+    explicit LatencyEstimator( DeadlineOptions const& options );
+
+    void record( std::string const& op, std::chrono::nanoseconds latency );
+
+    std::chrono::milliseconds deadline( std::string const& op ) const;
+
+private:
+    DeadlineOptions const& options_;
+    std::unordered_map< std::string, Estimate > estimates_;
+};
+
+/**
+ * class CircuitBreaker
+ *
+ * Opens after a number of consecutive failures and lets a single trial request through once the cooldown has passed.
+ */
+
+class CircuitBreaker
+{
+public:
+    enum class State
+    {
+        closed,
+        open,
+        halfOpen
+    };
+
+    explicit CircuitBreaker( BreakerOptions const& options );
+
+    State state() const { return state_; }
+
+    bool allow();
+
+    // returns true if the breaker closed again
+    bool success();
+    void failure();
+
+private:
+    BreakerOptions const& options_;
+    State state_ { State::closed };
+    std::size_t failures_ {};
+    Clock::time_point retryAt_;
+};
+
+/**
+ * class Backoff
+ *
+ * Exponentially growing retry delays. Half of each delay is random so clients that failed together don't retry
+ * together.
+ */
+
+class Backoff
+{
+public:
+    explicit Backoff( BackoffOptions const& options );
+
+    std::chrono::milliseconds next();
+    void reset();
+
+private:
+    BackoffOptions const& options_;
+    std::chrono::milliseconds current_ {};
+    std::minstd_rand random_;
+};
+
+/**
+ * class LinkState
+ *
+ * What the client is doing with the dSS right now, every transition is logged and counted.
+ */
+
+class LinkState
+{
+public:
+    enum class State : std::size_t
+    {
+        disconnected,
+        loggingIn,
+        subscribing,
+        polling,
+        degraded
+    };
+
+    LinkState();
+
+    State state() const { return state_; }
+
+    void enter( State state );
+
+private:
+    static constexpr std::size_t states = 5;
+
+    State state_ { State::disconnected };
+    std::array< Counter*, states > transitions_;
+};
+
+} // namespace dss
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_DSS_HEALTH_HPP
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <utility>
+
+#include <boost/asio/post.hpp>
+
+#include "dss_scheduler.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+
+namespace asio = boost::asio;
+
+namespace dsmq {
+namespace dss {
+
+RequestScheduler::RequestScheduler( asio::io_context& context, double rate, double burst )
+        : context_ { context }
+        , rate_ { rate }
+        , burst_ { max( burst, 1.0 ) }
+        , tokens_ { burst_ }
+        , refilled_ { Clock::now() }
+        , refillTimer_ { context }
+        , waitTimes_ { {
+                &Metrics::histogram( "dss.scheduler.wait.housekeeping" ),
+                &Metrics::histogram( "dss.scheduler.wait.interactive" ),
+                &Metrics::histogram( "dss.scheduler.wait.automation" ) } } {}
+
+void RequestScheduler::acquire( Priority priority, unsigned zone, asio::yield_context yield )
+{
+    auto enqueued = Clock::now();
+    auto& waitTime = *waitTimes_[ static_cast< size_t >( priority ) ];
+
+    if ( queued_ == 0 && take() ) {
+        waitTime.record( chrono::nanoseconds::zero() );
+        return;
+    }
+
+    Timer timer { context_, Clock::time_point::max() };
+    bool released {};
+    auto id = enqueue( priority, zone, [&] {
+        released = true;
+        timer.cancel();
+    } );
+
+    try {
+        boost::system::error_code ec;
+        while ( !released ) {
+            timer.async_wait( yield[ ec ] );
+        }
+    } catch ( ... ) {
+        remove( priority, zone, id );
+        throw;
+    }
+
+    waitTime.record( Clock::now() - enqueued );
+}
+
+void RequestScheduler::acquire( Priority priority, unsigned zone, function< void () > handler )
+{
+    auto enqueued = Clock::now();
+    auto& waitTime = *waitTimes_[ static_cast< size_t >( priority ) ];
+
+    if ( queued_ == 0 && take() ) {
+        waitTime.record( chrono::nanoseconds::zero() );
+        asio::post( context_, move( handler ));
+        return;
+    }
+
+    enqueue( priority, zone, [this, &waitTime, enqueued, handler = move( handler )] {
+        waitTime.record( Clock::now() - enqueued );
+        asio::post( context_, handler );
+    } );
+}
+
+size_t RequestScheduler::queued( unsigned zone ) const
+{
+    size_t result {};
+    for ( auto const& queue : queues_ ) {
+        auto it = queue.zones.find( zone );
+        if ( it != queue.zones.end() ) {
+            result += it->second.size();
+        }
+    }
+    return result;
+}
+
+size_t RequestScheduler::enqueue( Priority priority, unsigned zone, function< void () > release )
+{
+    auto id = nextId_++;
+    queues_[ static_cast< size_t >( priority ) ].zones[ zone ].push_back( { id, move( release ) } );
+    ++queued_;
+    dispatch();
+    return id;
+}
+
+void RequestScheduler::refill()
+{
+    auto now = Clock::now();
+    tokens_ = min( burst_, tokens_ + rate_ * chrono::duration< double >( now - refilled_ ).count());
+    refilled_ = now;
+}
+
+bool RequestScheduler::take()
+{
+    if ( rate_ <= 0 ) {
+        return true;
+    }
+
+    refill();
+    if ( tokens_ < 1 ) {
+        return false;
+    }
+    tokens_ -= 1;
+    return true;
+}
+
+void RequestScheduler::dispatch()
+{
+    while ( queued_ > 0 && take() ) {
+        auto queue = find_if( queues_.begin(), queues_.end(), []( auto const& q ) { return !q.zones.empty(); } );
+
+        auto zone = queue->zones.lower_bound( queue->next );
+        if ( zone == queue->zones.end() ) {
+            zone = queue->zones.begin();
+        }
+
+        auto waiter = move( zone->second.front() );
+        zone->second.pop_front();
+        queue->next = zone->first + 1;
+        if ( zone->second.empty() ) {
+            queue->zones.erase( zone );
+        }
+        --queued_;
+
+        waiter.release();
+    }
+
+    if ( queued_ > 0 ) {
+        refillTimer_.expires_after( chrono::duration_cast< Clock::duration >( chrono::duration< double >( ( 1 - tokens_ ) / rate_ )));
+        refillTimer_.async_wait( [this]( auto ec ) {
+            if ( ec != make_error_code( asio::error::operation_aborted )) {
+                this->dispatch();
+            }
+        } );
+    }
+}
+
+void RequestScheduler::remove( Priority priority, unsigned zone, size_t id )
+{
+    auto& zones = queues_[ static_cast< size_t >( priority ) ].zones;
+    auto it = zones.find( zone );
+    if ( it == zones.end() ) {
+        return;
+    }
+
+    auto pos = find_if( it->second.begin(), it->second.end(), [id]( auto const& waiter ) { return waiter.id == id; } );
+    if ( pos != it->second.end() ) {
+        it->second.erase( pos );
+        --queued_;
+    }
+    if ( it->second.empty() ) {
+        zones.erase( it );
+    }
+}
+
+} // namespace dss
+} // namespace dsmq
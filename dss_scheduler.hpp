@@ -0,0 +1,80 @@
+#ifndef DS_MQTT_BRIDGE_DSS_SCHEDULER_HPP
+#define DS_MQTT_BRIDGE_DSS_SCHEDULER_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/spawn.hpp>
+
+#include "clock.hpp"
+#include "dss_types.hpp"
+
+namespace dsmq {
+
+class Histogram;
+
+namespace dss {
+
+/**
+ * class RequestScheduler
+ *
+ * Token bucket limiting the rate of outbound requests. Waiting requests are released strictly by priority and
+ * round robin across zones within the same priority.
+ */
+
+class RequestScheduler
+{
+    struct Waiter
+    {
+        std::size_t id;
+        std::function< void () > release;
+    };
+
+    struct Queue
+    {
+        std::map< unsigned, std::deque< Waiter > > zones;
+        unsigned next {};
+    };
+
+    static constexpr std::size_t priorities = 3;
+
+public:
+    RequestScheduler( boost::asio::io_context& context, double rate, double burst );
+    RequestScheduler( RequestScheduler const& ) = delete;
+
+    // suspends the calling coroutine until the request may be sent
+    void acquire( Priority priority, unsigned zone, boost::asio::yield_context yield );
+
+    // posts the handler once the request may be sent, nothing but the handler is kept while waiting
+    void acquire( Priority priority, unsigned zone, std::function< void () > handler );
+
+    std::size_t queued( unsigned zone ) const;
+
+private:
+    void refill();
+    bool take();
+    std::size_t enqueue( Priority priority, unsigned zone, std::function< void () > release );
+    void dispatch();
+    void remove( Priority priority, unsigned zone, std::size_t id );
+
+    boost::asio::io_context& context_;
+    double rate_;
+    double burst_;
+    double tokens_;
+    Clock::time_point refilled_;
+    std::array< Queue, priorities > queues_;
+    std::size_t queued_ {};
+    std::size_t nextId_ {};
+    Timer refillTimer_;
+    std::array< Histogram*, priorities > waitTimes_;
+};
+
+} // namespace dss
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_DSS_SCHEDULER_HPP
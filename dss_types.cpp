@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <ostream>
+#include <stdexcept>
+#include <string>
 #include <utility>
 
 #include <nlohmann/json.hpp>
@@ -31,6 +34,59 @@ ostream& operator<<( ostream& os, Endpoint const& val )
     return os << "[dSS@" << val.host() << ":" << val.port() << "] ";
 }
 
+void from_json( json const& src, DeadlineOptions& dst )
+{
+    dst.initial_ = chrono::milliseconds( src.value( "initial", dst.initial_.count() ));
+    dst.minimum_ = chrono::milliseconds( src.value( "minimum", dst.minimum_.count() ));
+    dst.maximum_ = chrono::milliseconds( src.value( "maximum", dst.maximum_.count() ));
+    dst.multiplier_ = src.value( "multiplier", dst.multiplier_ );
+}
+
+void from_json( json const& src, BreakerOptions& dst )
+{
+    dst.threshold_ = src.value( "threshold", dst.threshold_ );
+    dst.cooldown_ = chrono::milliseconds( src.value( "cooldown", dst.cooldown_.count() ));
+    dst.queueWhenOpen_ = src.value( "whenOpen", "queue" ) == "queue";
+    dst.queueSize_ = src.value( "queueSize", dst.queueSize_ );
+}
+
+void from_json( json const& src, BackoffOptions& dst )
+{
+    dst.initial_ = chrono::milliseconds( src.value( "initial", dst.initial_.count() ));
+    dst.maximum_ = chrono::milliseconds( src.value( "maximum", dst.maximum_.count() ));
+    dst.multiplier_ = max( src.value( "multiplier", dst.multiplier_ ), 1.0 );
+}
+
+static constexpr size_t minimumStackSize = 64 * 1024;
+
+void from_json( json const& src, Options& dst )
+{
+    dst.overlappingPolls_ = src.value( "overlappingPolls", dst.overlappingPolls_ );
+    dst.deduplicationWindow_ = chrono::milliseconds( src.value( "deduplicationWindow", dst.deduplicationWindow_.count() ));
+    dst.sessionRefresh_ = chrono::milliseconds( src.value( "sessionRefresh", dst.sessionRefresh_.count() ));
+    dst.workers_ = max< size_t >( src.value( "workers", dst.workers_ ), 1 );
+    dst.stackSize_ = src.value( "stackSize", dst.stackSize_ );
+    // TLS handshakes and the Beast parser run on the stacks of the login, event loop and session refresh coroutines
+    if ( dst.stackSize_ > 0 && dst.stackSize_ < minimumStackSize ) {
+        throw invalid_argument( "dSS stackSize " + to_string( dst.stackSize_ ) + " is below the minimum of "
+                + to_string( minimumStackSize ) + " bytes" );
+    }
+    if ( src.count( "rateLimit" ) > 0 ) {
+        auto const& rateLimit = src.at( "rateLimit" );
+        dst.requestRate_ = rateLimit.value( "rate", dst.requestRate_ );
+        dst.requestBurst_ = rateLimit.value( "burst", dst.requestBurst_ );
+    }
+    if ( src.count( "deadlines" ) > 0 ) {
+        from_json( src.at( "deadlines" ), dst.deadlines_ );
+    }
+    if ( src.count( "breaker" ) > 0 ) {
+        from_json( src.at( "breaker" ), dst.breaker_ );
+    }
+    if ( src.count( "backoff" ) > 0 ) {
+        from_json( src.at( "backoff" ), dst.backoff_ );
+    }
+}
+
 void from_json( json const& src, EventCallScene& dst )
 {
     auto const& properties = src.at( "properties" );
@@ -39,5 +95,37 @@ void from_json( json const& src, EventCallScene& dst )
     dst.scene_ = stoul( properties.at( "sceneID" ).get< string >());
 }
 
+void from_json( json const& src, EventUndoScene& dst )
+{
+    auto const& properties = src.at( "properties" );
+    dst.zone_ = stoul( properties.at( "zoneID" ).get< string >());
+    dst.group_ = stoul( properties.at( "groupID" ).get< string >());
+    dst.scene_ = stoul( properties.at( "sceneID" ).get< string >());
+}
+
+void from_json( json const& src, EventDeviceSensorValue& dst )
+{
+    auto const& properties = src.at( "properties" );
+    dst.device_ = src.at( "source" ).at( "dsid" ).get< string >();
+    dst.sensorIndex_ = stoul( properties.at( "sensorIndex" ).get< string >());
+    dst.sensorType_ = stoul( properties.at( "sensorType" ).get< string >());
+    dst.value_ = stod( properties.at( "sensorValueFloat" ).get< string >());
+}
+
+void from_json( json const& src, EventZoneSensorValue& dst )
+{
+    auto const& properties = src.at( "properties" );
+    dst.zone_ = stoul( properties.at( "zoneID" ).get< string >());
+    dst.sensorType_ = stoul( properties.at( "sensorType" ).get< string >());
+    dst.value_ = stod( properties.at( "sensorValueFloat" ).get< string >());
+}
+
+void from_json( json const& src, EventStateChange& dst )
+{
+    auto const& properties = src.at( "properties" );
+    dst.stateName_ = properties.at( "statename" ).get< string >();
+    dst.state_ = properties.at( "state" ).get< string >();
+}
+
 } // namespace dss
 } // namespace dsmq
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef DS_MQTT_BRIDGE_DSS_TYPES_HPP
 #define DS_MQTT_BRIDGE_DSS_TYPES_HPP
 
+#include <chrono>
+#include <cstddef>
 #include <iosfwd>
 #include <string>
 
@@ -29,6 +31,95 @@ private:
     std::string apikey_;
 };
 
+enum class Priority : std::size_t
+{
+    housekeeping,
+    interactive,
+    automation
+};
+
+class DeadlineOptions
+{
+    friend void from_json( nlohmann::json const& src, DeadlineOptions& dst );
+
+public:
+    std::chrono::milliseconds initial() const { return initial_; }
+    std::chrono::milliseconds minimum() const { return minimum_; }
+    std::chrono::milliseconds maximum() const { return maximum_; }
+    double multiplier() const { return multiplier_; }
+
+private:
+    std::chrono::milliseconds initial_ { 10000 };
+    std::chrono::milliseconds minimum_ { 1000 };
+    std::chrono::milliseconds maximum_ { 30000 };
+    double multiplier_ { 4 };
+};
+
+class BreakerOptions
+{
+    friend void from_json( nlohmann::json const& src, BreakerOptions& dst );
+
+public:
+    std::size_t threshold() const { return threshold_; }
+    std::chrono::milliseconds cooldown() const { return cooldown_; }
+    bool queueWhenOpen() const { return queueWhenOpen_; }
+    std::size_t queueSize() const { return queueSize_; }
+
+private:
+    std::size_t threshold_ { 5 };
+    std::chrono::milliseconds cooldown_ { 10000 };
+    bool queueWhenOpen_ { true };
+    std::size_t queueSize_ { 32 };
+};
+
+class BackoffOptions
+{
+    friend void from_json( nlohmann::json const& src, BackoffOptions& dst );
+
+public:
+    std::chrono::milliseconds initial() const { return initial_; }
+    std::chrono::milliseconds maximum() const { return maximum_; }
+    double multiplier() const { return multiplier_; }
+
+private:
+    std::chrono::milliseconds initial_ { 500 };
+    std::chrono::milliseconds maximum_ { 60000 };
+    double multiplier_ { 2 };
+};
+
+class Options
+{
+    friend void from_json( nlohmann::json const& src, Options& dst );
+
+public:
+    bool overlappingPolls() const { return overlappingPolls_; }
+    std::chrono::milliseconds deduplicationWindow() const { return deduplicationWindow_; }
+    double requestRate() const { return requestRate_; }
+    double requestBurst() const { return requestBurst_; }
+    DeadlineOptions const& deadlines() const { return deadlines_; }
+    BreakerOptions const& breaker() const { return breaker_; }
+    BackoffOptions const& backoff() const { return backoff_; }
+    std::chrono::milliseconds sessionRefresh() const { return sessionRefresh_; }
+    std::size_t workers() const { return workers_; }
+    std::size_t stackSize() const { return stackSize_; }
+
+private:
+    bool overlappingPolls_ {};
+    // how long overlapping polls' copies of an event are recognized; never shorter than the longest backoff plus a
+    // poll, which is what a lagging poller can be behind
+    std::chrono::milliseconds deduplicationWindow_ {};
+    double requestRate_ { 10 };
+    double requestBurst_ { 10 };
+    DeadlineOptions deadlines_;
+    BreakerOptions breaker_;
+    BackoffOptions backoff_;
+    // off by default, the event loop's polls keep the session alive; when set, a request is made with the token at
+    // this interval so it doesn't time out while the bridge is otherwise idle
+    std::chrono::milliseconds sessionRefresh_ {};
+    std::size_t workers_ { 4 };
+    std::size_t stackSize_ {};
+};
+
 class EventCallScene
 {
     friend void from_json( nlohmann::json const& src, EventCallScene& dst );
@@ -46,6 +137,74 @@ private:
     unsigned scene_ {};
 };
 
+class EventUndoScene
+{
+    friend void from_json( nlohmann::json const& src, EventUndoScene& dst );
+
+public:
+    static constexpr char const* name = "undoScene";
+
+    unsigned zone() const { return zone_; }
+    unsigned group() const { return group_; }
+    unsigned scene() const { return scene_; }
+
+private:
+    unsigned zone_ {};
+    unsigned group_ {};
+    unsigned scene_ {};
+};
+
+class EventDeviceSensorValue
+{
+    friend void from_json( nlohmann::json const& src, EventDeviceSensorValue& dst );
+
+public:
+    static constexpr char const* name = "deviceSensorValue";
+
+    std::string const& device() const { return device_; }
+    unsigned sensorIndex() const { return sensorIndex_; }
+    unsigned sensorType() const { return sensorType_; }
+    double value() const { return value_; }
+
+private:
+    std::string device_;
+    unsigned sensorIndex_ {};
+    unsigned sensorType_ {};
+    double value_ {};
+};
+
+class EventZoneSensorValue
+{
+    friend void from_json( nlohmann::json const& src, EventZoneSensorValue& dst );
+
+public:
+    static constexpr char const* name = "zoneSensorValue";
+
+    unsigned zone() const { return zone_; }
+    unsigned sensorType() const { return sensorType_; }
+    double value() const { return value_; }
+
+private:
+    unsigned zone_ {};
+    unsigned sensorType_ {};
+    double value_ {};
+};
+
+class EventStateChange
+{
+    friend void from_json( nlohmann::json const& src, EventStateChange& dst );
+
+public:
+    static constexpr char const* name = "stateChange";
+
+    std::string const& stateName() const { return stateName_; }
+    std::string const& state() const { return state_; }
+
+private:
+    std::string stateName_;
+    std::string state_;
+};
+
 } // namespace dss
 } // namespace dsmq
 
@@ -18,6 +18,7 @@ string dsmq_category::message( int value ) const
         case dsmq_errc::server_error: return "server side error";
         case dsmq_errc::protocol_violation: return "protocol violation";
         case dsmq_errc::timeout: return "timeout";
+        case dsmq_errc::unauthorized: return "not authorized";
     }
     return "unknown dsmq::dsmq_category error";
 }
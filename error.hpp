@@ -16,7 +16,8 @@ enum class dsmq_errc : int
     exception,
     server_error,
     protocol_violation,
-    timeout
+    timeout,
+    unauthorized
 };
 
 
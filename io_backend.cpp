@@ -0,0 +1,43 @@
+#include <system_error>
+
+#include <boost/asio/detail/config.hpp>
+
+#if defined( DSMQ_IO_URING )
+#   include <liburing.h>
+#endif
+
+#include "io_backend.hpp"
+
+using namespace std;
+
+namespace dsmq {
+
+char const* IoBackend::name()
+{
+#if defined( DSMQ_IO_URING )
+    return "io_uring";
+#elif defined( BOOST_ASIO_HAS_IOCP )
+    return "iocp";
+#elif defined( BOOST_ASIO_HAS_EPOLL )
+    return "epoll";
+#elif defined( BOOST_ASIO_HAS_KQUEUE )
+    return "kqueue";
+#else
+    return "select";
+#endif
+}
+
+void IoBackend::check()
+{
+#if defined( DSMQ_IO_URING )
+    io_uring ring;
+    auto result = io_uring_queue_init( 16, &ring, 0 );
+    if ( result < 0 ) {
+        throw system_error( -result, system_category(),
+                "this build needs io_uring, use a build without DSMQ_IO_URING on this kernel" );
+    }
+    io_uring_queue_exit( &ring );
+#endif
+}
+
+} // namespace dsmq
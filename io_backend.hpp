@@ -0,0 +1,24 @@
+#ifndef DS_MQTT_BRIDGE_IO_BACKEND_HPP
+#define DS_MQTT_BRIDGE_IO_BACKEND_HPP
+
+namespace dsmq {
+
+/**
+ * class IoBackend
+ *
+ * The mechanism Asio was built to wait for sockets and files with. Asio picks it at compile time, so a build on
+ * io_uring can't fall back to epoll when the kernel lacks io_uring, check() reports that before anything is opened.
+ */
+
+class IoBackend
+{
+public:
+    static char const* name();
+
+    // throws std::system_error if the kernel doesn't provide what this build needs
+    static void check();
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_IO_BACKEND_HPP
@@ -0,0 +1,293 @@
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <set>
+#include <utility>
+#include <vector>
+#include <experimental/string_view>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/write.hpp>
+#include <nlohmann/json.hpp>
+
+#include "local_api.hpp"
+#include "logging.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+using namespace std::experimental;
+using namespace nlohmann;
+
+namespace asio = boost::asio;
+
+namespace dsmq {
+
+static Logger logger( "local_api" );
+
+static Counter& commandsReceived = Metrics::counter( "local.commands.received" );
+static Counter& scenesSent = Metrics::counter( "local.scenes.sent" );
+static Counter& scenesDropped = Metrics::counter( "local.scenes.dropped" );
+
+enum class FrameType : uint8_t
+{
+    subscribe = 1,
+    unsubscribe = 2,
+    command = 3,
+    scene = 4
+};
+
+static constexpr size_t frameHeaderLength = 3;
+
+#if defined( BOOST_ASIO_HAS_LOCAL_SOCKETS )
+
+using Protocol = asio::local::stream_protocol;
+
+static string encodeFrame( FrameType type, initializer_list< string_view > fields )
+{
+    string result( frameHeaderLength, '\0' );
+    for ( auto field : fields ) {
+        auto length = min< size_t >( field.size(), 0xff );
+        result.push_back( static_cast< char >( length ));
+        result.append( field.data(), length );
+    }
+    auto length = result.size() - frameHeaderLength;
+    result[ 0 ] = static_cast< char >( length & 0xff );
+    result[ 1 ] = static_cast< char >( ( length >> 8 ) & 0xff );
+    result[ 2 ] = static_cast< char >( type );
+    return result;
+}
+
+static bool decodeFields( string const& body, vector< string >& fields )
+{
+    size_t offset {};
+    while ( offset < body.size() ) {
+        auto length = static_cast< uint8_t >( body[ offset++ ] );
+        if ( offset + length > body.size() ) {
+            return false;
+        }
+        fields.emplace_back( body, offset, length );
+        offset += length;
+    }
+    return true;
+}
+
+class LocalApi::Impl
+{
+    class Session : public enable_shared_from_this< Session >
+    {
+    public:
+        Session( Impl& owner, Protocol::socket socket )
+                : owner_ { owner }
+                , socket_ { move( socket ) } {}
+
+        bool subscribed() const { return subscribed_; }
+
+        void start()
+        {
+            asio::spawn( owner_.context_, [self = shared_from_this()]( auto yield ) {
+                try {
+                    self->readLoop( yield );
+                } catch ( boost::system::system_error const& e ) {
+                    if ( e.code() != asio::error::eof && e.code() != asio::error::operation_aborted ) {
+                        logger.warning( "local client failed: ", e.what() );
+                    }
+                }
+                self->close();
+            } );
+        }
+
+        void send( string frame )
+        {
+            if ( queued_ + frame.size() > owner_.maxQueued_ ) {
+                if ( !overflowing_ ) {
+                    logger.warning( "local client is too slow, dropping scenes" );
+                    overflowing_ = true;
+                }
+                scenesDropped.increment();
+                return;
+            }
+            overflowing_ = false;
+            queued_ += frame.size();
+            pending_.push_back( move( frame ));
+            scenesSent.increment();
+            if ( writing_.empty() ) {
+                flush();
+            }
+        }
+
+        void close()
+        {
+            boost::system::error_code ec;
+            socket_.close( ec );
+            owner_.sessions_.erase( shared_from_this() );
+        }
+
+    private:
+        void readLoop( asio::yield_context yield )
+        {
+            char header[ frameHeaderLength ];
+            string body;
+            while ( true ) {
+                asio::async_read( socket_, asio::buffer( header ), yield );
+                auto length = static_cast< size_t >( static_cast< uint8_t >( header[ 0 ] ))
+                        | static_cast< size_t >( static_cast< uint8_t >( header[ 1 ] )) << 8;
+                body.resize( length );
+                asio::async_read( socket_, asio::buffer( &body[ 0 ], body.size() ), yield );
+
+                switch ( static_cast< FrameType >( header[ 2 ] )) {
+                    case FrameType::subscribe:
+                        subscribed_ = true;
+                        break;
+
+                    case FrameType::unsubscribe:
+                        subscribed_ = false;
+                        break;
+
+                    case FrameType::command: {
+                        vector< string > fields;
+                        if ( !decodeFields( body, fields ) || fields.size() != 3 ) {
+                            logger.warning( "malformed command from local client, closing connection" );
+                            return;
+                        }
+                        commandsReceived.increment();
+                        owner_.handler_( fields[ 0 ], fields[ 1 ], fields[ 2 ] );
+                        break;
+                    }
+
+                    default:
+                        logger.warning( "unknown frame type ", static_cast< unsigned >( static_cast< uint8_t >( header[ 2 ] )),
+                                " from local client, closing connection" );
+                        return;
+                }
+            }
+        }
+
+        // everything queued while the previous batch was written goes out in one write
+        void flush()
+        {
+            writing_ = move( pending_ );
+            pending_.clear();
+
+            vector< asio::const_buffer > buffers;
+            buffers.reserve( writing_.size() );
+            for ( auto const& frame : writing_ ) {
+                buffers.push_back( asio::buffer( frame ));
+            }
+
+            asio::async_write( socket_, buffers, [self = shared_from_this()]( auto ec, size_t written ) {
+                self->queued_ -= written;
+                self->writing_.clear();
+                if ( ec ) {
+                    self->close();
+                } else if ( !self->pending_.empty() ) {
+                    self->flush();
+                }
+            } );
+        }
+
+        Impl& owner_;
+        Protocol::socket socket_;
+        bool subscribed_ {};
+        bool overflowing_ {};
+        size_t queued_ {};
+        deque< string > pending_;
+        deque< string > writing_;
+    };
+
+public:
+    Impl( asio::io_context& context, json const& props, CommandHandler&& handler )
+            : context_ { context }
+            , path_ { props.at( "path" ).get< string >() }
+            , maxQueued_ { props.value( "maxQueued", size_t { 64 } * 1024 ) }
+            , handler_ { move( handler ) }
+            , acceptor_ { context }
+    {
+        // a socket file left behind by a previous run would make bind fail
+        remove( path_.c_str() );
+
+        Protocol::endpoint endpoint { path_ };
+        acceptor_.open( endpoint.protocol() );
+        acceptor_.bind( endpoint );
+        acceptor_.listen();
+        logger.info( "accepting local clients on ", path_ );
+
+        accept();
+    }
+
+    ~Impl()
+    {
+        boost::system::error_code ec;
+        acceptor_.close( ec );
+        remove( path_.c_str() );
+    }
+
+    void publish( string const& zone, string const& group, string const& scene )
+    {
+        if ( sessions_.empty() ) {
+            return;
+        }
+
+        auto frame = encodeFrame( FrameType::scene, { zone, group, scene } );
+        for ( auto const& session : sessions_ ) {
+            if ( session->subscribed() ) {
+                session->send( frame );
+            }
+        }
+    }
+
+private:
+    void accept()
+    {
+        acceptor_.async_accept( [this]( auto ec, Protocol::socket socket ) {
+            if ( ec == asio::error::operation_aborted ) {
+                return;
+            }
+            if ( ec ) {
+                logger.error( "couldn't accept local client: ", ec.message() );
+            } else {
+                logger.debug( "local client connected" );
+                auto session = make_shared< Session >( *this, move( socket ));
+                sessions_.insert( session );
+                session->start();
+            }
+            this->accept();
+        } );
+    }
+
+    asio::io_context& context_;
+    string path_;
+    size_t maxQueued_;
+    CommandHandler handler_;
+    Protocol::acceptor acceptor_;
+    set< shared_ptr< Session >> sessions_;
+};
+
+#else
+
+class LocalApi::Impl
+{
+public:
+    Impl( asio::io_context&, json const&, CommandHandler&& )
+    {
+        logger.warning( "local sockets aren't supported on this platform, local API disabled" );
+    }
+
+    void publish( string const&, string const&, string const& ) {}
+};
+
+#endif
+
+LocalApi::LocalApi( asio::io_context& context, json const& props, CommandHandler handler )
+        : impl_ { make_unique< Impl >( context, props, move( handler )) } {}
+
+LocalApi::~LocalApi() = default;
+
+void LocalApi::publish( string const& zone, string const& group, string const& scene )
+{
+    impl_->publish( zone, group, scene );
+}
+
+} // namespace dsmq
@@ -0,0 +1,49 @@
+#ifndef DS_MQTT_BRIDGE_LOCAL_API_HPP
+#define DS_MQTT_BRIDGE_LOCAL_API_HPP
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <boost/asio/io_context.hpp>
+#include <nlohmann/json_fwd.hpp>
+
+namespace dsmq {
+
+/**
+ * class LocalApi
+ *
+ * Scene events and commands for consumers on the same host, over a Unix domain socket. Every frame is
+ *
+ *   uint16   length of the body (little endian)
+ *   uint8    type
+ *   char[]   body, a sequence of strings each preceded by its uint8 length
+ *
+ * Frame types:
+ *   1 subscribe     client to bridge, no body, starts the stream of scene frames
+ *   2 unsubscribe   client to bridge, no body
+ *   3 command       client to bridge, body zone, group, scene as in the MQTT topics and payloads
+ *   4 scene         bridge to client, body zone, group, scene of a scene that became active
+ *
+ * Frames for a client are written in batches. Scenes that don't fit the client's queue limit are dropped.
+ */
+
+class LocalApi
+{
+    class Impl;
+
+public:
+    using CommandHandler = std::function< void ( std::string const& zone, std::string const& group, std::string const& scene ) >;
+
+    LocalApi( boost::asio::io_context& context, nlohmann::json const& props, CommandHandler handler );
+    ~LocalApi();
+
+    void publish( std::string const& zone, std::string const& group, std::string const& scene );
+
+private:
+    std::unique_ptr< Impl > impl_;
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_LOCAL_API_HPP
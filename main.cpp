@@ -1,32 +1,16 @@
-#include <fstream>
 #include <iostream>
-#include <string>
-
-#include <nlohmann/json.hpp>
 
 #include "commandline.hpp"
+#include "io_backend.hpp"
 #include "logging.hpp"
 #include "manager.hpp"
 
 using namespace std;
-using namespace nlohmann;
 
 namespace dsmq {
 
 static Logger logger( "main" );
 
-json readProperties( string const& fileName )
-{
-    ifstream ifs { fileName, ios::in };
-    if ( !ifs ) {
-        throw system_error( errno, system_category(), "couldn't open " + fileName );
-    }
-
-    json props;
-    ifs >> props;
-    return props;
-}
-
 void run( int argc, char* const argv[] )
 {
     try {
@@ -37,9 +21,10 @@ void run( int argc, char* const argv[] )
             Logger::output( args.logFile().c_str());
         }
 
-        logger.info( "dsmqbridge starting" );
+        logger.info( "dsmqbridge starting, waiting for I/O with ", IoBackend::name() );
+        IoBackend::check();
 
-        Manager manager { readProperties( args.propertiesFile()) };
+        Manager manager { args.propertiesFile() };
         manager.run();
     } catch ( CommandLineError const& e ) {
         std::cerr << e.what();
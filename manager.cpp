@@ -1,23 +1,40 @@
 #include <csignal>
 #include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
 #include <list>
+#include <map>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 #include <experimental/optional>
+#include <experimental/string_view>
 
 #include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/asio/ssl/context.hpp>
-#include <boost/asio/steady_timer.hpp>
 #include <boost/format.hpp>
 #include <nlohmann/json.hpp>
 
+#include "allocations.hpp"
+#include "capture.hpp"
+#include "clock.hpp"
 #include "dss_client.hpp"
+#include "local_api.hpp"
 #include "logging.hpp"
 #include "manager.hpp"
+#include "metrics.hpp"
 #include "mqtt_client.hpp"
+#include "profiler.hpp"
+#include "routing_image.hpp"
+#include "sensor_filter.hpp"
+#include "thread.hpp"
+#include "timeline.hpp"
+#include "trace.hpp"
 
 using namespace std;
 using namespace std::experimental;
@@ -30,157 +47,615 @@ namespace dsmq {
 
 static Logger logger( "manager" );
 
-class MappingTable
+static Counter& commandsReceived = Metrics::counter( "mqtt.commands.received" );
+static Counter& commandsCoalesced = Metrics::counter( "mqtt.commands.coalesced" );
+static Counter& commandsForwarded = Metrics::counter( "mqtt.commands.forwarded" );
+static Counter& eventsForwarded = Metrics::counter( "dss.events.forwarded" );
+
+static Profiler::Site& callSceneSite = Profiler::site( "on_callScene" );
+static Profiler::Site& dssEventSite = Profiler::site( "on_event" );
+static Profiler::Site& sensorValueSite = Profiler::site( "on_sensorValue" );
+static Profiler::Site& coalesceSite = Profiler::site( "coalesce.timer" );
+static Profiler::Site& metricsSite = Profiler::site( "metrics.report" );
+static AllocationBudget::Site& dssEventBudget = AllocationBudget::site( "dss.event" );
+static AllocationBudget::Site& mqttCommandBudget = AllocationBudget::site( "mqtt.command" );
+
+struct Configuration
+{
+    json props;
+    shared_ptr< RoutingImage const > image;
+    string source;
+};
+
+enum class TopicKind
 {
-    friend void from_json( json const& src, MappingTable& dst )
+    command,
+    stateQuery,
+    zoneCommand
+};
+
+using Subscriptions = map< string, tuple< TopicKind, string, string > >;
+
+class Routing
+{
+public:
+    Routing( json const& props, shared_ptr< RoutingImage const > image )
+            : topicTemplate_ { props.at( "topicTemplate" ).get< string >() }
+            , image_ { move( image ) }
+            , zoneTable_ { image_->zones() }
+            , groupTable_ { image_->groups() }
+            , sceneTable_ { image_->scenes() }
     {
-        for ( auto const& item : src ) {
-            dst.mqs_.push_back( item.at( "MQ" ));
-            dst.mq2ds_.emplace( item.at( "MQ" ), item.at( "dS" ));
-            dst.ds2mq_.emplace( item.at( "dS" ), item.at( "MQ" ));
+        auto const& state = props.value( "state", json::object() );
+        stateTopicTemplate_ = state.value( "topicTemplate", "" );
+        queryTopicTemplate_ = state.value( "queryTopicTemplate", "" );
+        skipActiveScenes_ = state.value( "skipActive", false );
+
+        auto const& aggregate = props.value( "aggregate", json::object() );
+        aggregateTopicTemplate_ = aggregate.value( "topicTemplate", "" );
+
+        auto const& coalesce = props.value( "coalesce", json::object() );
+        coalesceWindow_ = chrono::milliseconds( coalesce.value( "window", 0 ));
+        auto zones = coalesce.value( "zones", json::object() );
+        for ( auto const& zone : zones.items() ) {
+            zoneCoalesceWindows_.emplace( zone.key(), chrono::milliseconds( zone.value().get< unsigned >() ));
+        }
+
+        // the topics of the mapped groups are formatted once here instead of for every message
+        for ( auto zone : zoneTable_.mqs() ) {
+            auto& groups = topics_[ zone.to_string() ];
+            for ( auto group : zoneTable_.groupsByMq( zone, groupTable_ ) ) {
+                groups[ group.to_string() ] = {
+                        formatTopic( topicTemplate_, zone, group ),
+                        publishesState() ? formatTopic( stateTopicTemplate_, zone, group ) : string() };
+            }
         }
     }
 
-public:
-    vector< string > const& mqs() const { return mqs_; }
+    ZoneTable const& zones() const { return zoneTable_; }
+    MappingTable const& groups() const { return groupTable_; }
+    MappingTable const& scenes() const { return sceneTable_; }
 
-    optional< unsigned > mq2ds( string const& val ) const
+    bool publishesState() const { return !stateTopicTemplate_.empty(); }
+    bool skipsActiveScenes() const { return skipActiveScenes_; }
+    bool aggregatesZones() const { return !aggregateTopicTemplate_.empty(); }
+
+    chrono::milliseconds coalesceWindow( string const& zone ) const
     {
-        auto it = mq2ds_.find( val );
-        return it != mq2ds_.end() ? optional< unsigned > { it->second } : nullopt;
+        auto it = zoneCoalesceWindows_.find( zone );
+        return it != zoneCoalesceWindows_.end() ? it->second : coalesceWindow_;
     }
 
-    string const* ds2mq( unsigned val ) const
+    string topicName( string_view zone, string_view group ) const
     {
-        auto it = ds2mq_.find( val );
-        return it != ds2mq_.end() ? &it->second : nullptr;
+        auto topics = find( zone, group );
+        return topics ? topics->command : formatTopic( topicTemplate_, zone, group );
     }
 
-private:
-    vector< string > mqs_;
-    unordered_map< string, unsigned > mq2ds_;
-    unordered_map< unsigned, string > ds2mq_;
-};
+    string stateTopicName( string_view zone, string_view group ) const
+    {
+        auto topics = find( zone, group );
+        return topics ? topics->state : formatTopic( stateTopicTemplate_, zone, group );
+    }
 
-class ZoneTable : MappingTable
-{
-    friend void from_json( json const& src, ZoneTable& dst )
+    string aggregateTopicName( string_view zone ) const
+    {
+        return ( boost::format( aggregateTopicTemplate_ ) % zone ).str();
+    }
+
+    Subscriptions subscriptions() const
     {
-        from_json( src, static_cast< MappingTable& >( dst ));
-        for ( auto const& item : src ) {
-            if ( item.count( "groups" ) > 0 ) {
-                dst.groupsByMq_.emplace( item.at( "MQ" ), item.at( "groups" ));
+        Subscriptions result;
+        for ( auto zone : zoneTable_.mqs() ) {
+            if ( aggregatesZones() ) {
+                result.emplace( aggregateTopicName( zone ), make_tuple( TopicKind::zoneCommand, zone.to_string(), string() ));
             }
-            if ( item.count( "scenes" ) > 0 ) {
-                dst.sceneOverrides_.emplace( item.at( "MQ" ), item.at( "scenes" ));
+            for ( auto group : zoneTable_.groupsByMq( zone, groupTable_ ) ) {
+                result.emplace( topicName( zone, group ), make_tuple( TopicKind::command, zone.to_string(), group.to_string() ));
+                if ( publishesState() && !queryTopicTemplate_.empty() ) {
+                    result.emplace( ( boost::format( queryTopicTemplate_ ) % zone % group ).str(),
+                            make_tuple( TopicKind::stateQuery, zone.to_string(), group.to_string() ));
+                }
             }
         }
+        return result;
     }
 
-public:
-    using MappingTable::mqs;
-    using MappingTable::mq2ds;
-    using MappingTable::ds2mq;
+private:
+    struct GroupTopics
+    {
+        string command;
+        string state;
+    };
 
-    vector< string > const& groupsByMq( string const& zone, MappingTable const& groupTable ) const
+    static string formatTopic( string const& topicTemplate, string_view zone, string_view group )
     {
-        auto it = groupsByMq_.find( zone );
-        return it != groupsByMq_.end() ? it->second : groupTable.mqs();
+        return ( boost::format( topicTemplate ) % zone % group ).str();
     }
 
-    string const* groupDS2Mq( string const& zone, unsigned group, MappingTable const& groupTable ) const
+    GroupTopics const* find( string_view zone, string_view group ) const
     {
-        if ( auto result = groupTable.ds2mq( group ) ) {
-            auto it = groupsByMq_.find( zone );
-            if ( it == groupsByMq_.end() || find( it->second.begin(), it->second.end(), *result ) != it->second.end() ) {
-                return result;
-            }
+        auto groups = topics_.find( zone );
+        if ( groups == topics_.end() ) {
+            return nullptr;
         }
-        return nullptr;
+        auto it = groups->second.find( group );
+        return it != groups->second.end() ? &it->second : nullptr;
     }
 
-    optional< unsigned > sceneMq2DS( string const& zone, string const& scene, MappingTable const& sceneTable ) const
+    string topicTemplate_;
+    shared_ptr< RoutingImage const > image_;
+    ZoneTable zoneTable_;
+    MappingTable groupTable_;
+    MappingTable sceneTable_;
+    string stateTopicTemplate_;
+    string queryTopicTemplate_;
+    bool skipActiveScenes_ {};
+    string aggregateTopicTemplate_;
+    chrono::milliseconds coalesceWindow_ {};
+    unordered_map< string, chrono::milliseconds > zoneCoalesceWindows_;
+    map< string, map< string, GroupTopics, less<> >, less<> > topics_;
+};
+
+struct PendingCommand
+{
+    PendingCommand( asio::io_context& context, chrono::milliseconds window, string_view scene )
+            : timer { context, window }
+            , scene { scene.to_string() } {}
+
+    Timer timer;
+    string scene;
+    bool coalesced {};
+};
+
+class Manager::Impl
+{
+public:
+    explicit Impl( string const& propertiesFile )
+            : Impl { propertiesFile, readProperties( propertiesFile ) } {}
+
+    ~Impl()
     {
-        auto it = sceneOverrides_.find( zone );
-        if ( it != sceneOverrides_.end()) {
-            if ( auto result = it->second.mq2ds( scene )) {
-                return result;
-            }
+        if ( routingLoader_.joinable() ) {
+            routingLoader_.join();
         }
-        return sceneTable.mq2ds( scene );
     }
 
-    string const* sceneDS2Mq( string const& zone, unsigned scene, MappingTable const& sceneTable ) const
+    void run()
     {
-        auto it = sceneOverrides_.find( zone );
-        if ( it != sceneOverrides_.end()) {
-            if ( auto result = it->second.ds2mq( scene )) {
-                return result;
+        Thread::configure( "io", threadOptions( "io" ));
+        context_.run();
+    }
+
+    void on_event( dss::EventCallScene&& event )
+    {
+        Profiler::Scope scope { dssEventSite };
+        AllocationBudget::Scope budget { dssEventBudget };
+        logger.debug( "received dSS callScene from zone ", event.zone(), ", group ", event.group(), ", scene ", event.scene() );
+
+        // the echo of a scene we called is not sent back to MQTT, but it is what confirms the new state
+        auto range = forwardedDSScenes_.equal_range( forward_as_tuple( event.zone(), event.group(), event.scene()));
+        auto echo = range.first != range.second;
+        if ( echo ) {
+            DSMQ_TRACE3( dss_echo_suppressed, event.zone(), event.group(), event.scene() );
+            forwardedDSScenes_.erase( range.first );
+        }
+
+        auto const& zoneTable = routing_->zones();
+        auto mappedZone = zoneTable.ds2mq( event.zone());
+        if ( !mappedZone ) {
+            DSMQ_TRACE4( dss_route, event.zone(), event.group(), event.scene(), 0 );
+            return;
+        }
+        auto targetZone = mappedZone->to_string();
+
+        // a scene without MQTT mapping leaves the state of the affected groups unknown
+        auto mappedScene = zoneTable.sceneDS2Mq( targetZone, event.scene(), routing_->scenes() );
+        DSMQ_TRACE4( dss_route, event.zone(), event.group(), event.scene(), mappedScene ? 1 : 0 );
+        auto targetScene = mappedScene ? mappedScene->to_string() : string();
+        auto forward = [&]( string_view targetGroup ) {
+            if ( !mappedScene ) {
+                clearState( targetZone, targetGroup.to_string() );
+            } else if ( echo ) {
+                updateState( targetZone, targetGroup.to_string(), targetScene );
+            } else {
+                forwardMq( targetZone, targetGroup.to_string(), targetScene );
             }
+        };
+
+        if ( event.group() == 0 ) {
+            auto targetGroups = zoneTable.groupsByMq( targetZone, routing_->groups() );
+            if ( mappedScene && !echo && routing_->aggregatesZones() ) {
+                forwardMqZone( targetZone, targetGroups, targetScene );
+                return;
+            }
+            for ( auto targetGroup : targetGroups ) {
+                forward( targetGroup );
+            }
+        } else if ( auto targetGroup = zoneTable.groupDS2Mq( targetZone, event.group(), routing_->groups() )) {
+            forward( *targetGroup );
         }
-        return sceneTable.ds2mq( scene );
     }
 
-private:
-    unordered_map< string, vector< string > > groupsByMq_;
-    unordered_map< string, MappingTable > sceneOverrides_;
-};
+    void on_event( dss::EventZoneSensorValue&& event )
+    {
+        Profiler::Scope scope { sensorValueSite };
+        if ( !routing_->zones().ds2mq( event.zone())) {
+            return;
+        }
 
-class Manager::Impl
-{
-public:
-    explicit Impl( json const& props )
-            : topicTemplate_ { props.at( "topicTemplate" ).get< string >() }
-            , zoneTable_ { props.at( "zones" ) }
-            , groupTable_ { props.at( "groups" ) }
-            , sceneTable_ { props.at( "scenes" ) }
+        if ( auto value = sensorFilter_->filter( event.zone(), event.sensorType(), event.value(), Clock::now() )) {
+            publishSensorValue( event.zone(), event.sensorType(), *value );
+        }
+    }
+
+private:
+    Impl( string const& propertiesFile, Configuration&& config )
+            : propertiesFile_ { propertiesFile }
+            , props_( move( config.props ))
+            , image_ { move( config.image ) }
+            , source_ { move( config.source ) }
             , reloadSignals_ { context_ }
-            , mqtt_ { context_, props.at( "MQTT" ) }
-            , dss_ { context_, sslContext_, props.at( "dSS" ) }
+            , capture_ { props_.count( "capture" ) > 0 ? make_unique< Capture >( props_.at( "capture" )) : nullptr }
+            , mqtt_ { context_, props_.at( "MQTT" ), capture_.get(), threadOptions( "mqtt" ) }
+            , dss_ { context_, sslContext_, props_.at( "dSS" ), props_.at( "dSS" ), capture_.get() }
     {
+        StartupTimeline::mark( "configuration loaded" );
+
 #if !defined( WIN32 )
         reloadSignals_.add( SIGHUP );
 #endif
         subscribeReloadSignals();
 
-        for ( auto const& zone : zoneTable_.mqs() ) {
-            for ( auto const& group : zoneTable_.groupsByMq( zone, groupTable_ ) ) {
-                mqtt_.subscribe(
-                        topicName( zone, group ),
-                        [this, &zone, &group]( auto payload ) { this->on_callScene( zone, group, move( payload )); } );
+        auto const& metrics = props_.value( "metrics", json::object() );
+        metricsInterval_ = chrono::seconds( metrics.value( "interval", 0 ));
+        metricsTopic_ = metrics.value( "topic", "" );
+        if ( metricsInterval_ != chrono::seconds::zero() ) {
+            scheduleMetrics();
+        }
+
+        if ( props_.count( "profiling" ) > 0 ) {
+            auto const& profiling = props_.at( "profiling" );
+            Profiler::threshold( chrono::milliseconds( profiling.value( "slowHandler", 50 )));
+            profileTop_ = profiling.value( "top", 5 );
+            lagProbe_ = make_unique< LagProbe >( context_, chrono::milliseconds( profiling.value( "lagInterval", 250 )));
+        }
+
+        if ( props_.count( "sensors" ) > 0 ) {
+            auto const& sensors = props_.at( "sensors" );
+            sensorTopicTemplate_ = sensors.at( "topicTemplate" ).get< string >();
+            sensorSweepInterval_ = chrono::milliseconds( sensors.value( "sweepInterval", 1000 ));
+            sensorFilter_ = make_unique< SensorFilter >( sensors );
+        }
+
+        if ( props_.count( "allocations" ) > 0 ) {
+            configureBudgets( props_.at( "allocations" ));
+        }
+
+        // log into the dSS while the routing tables are built off the io thread
+        dss_.connect();
+        routingLoader_ = thread { [this, options = threadOptions( "routing" )] {
+            Thread::configure( "routing", options );
+            shared_ptr< Routing > routing;
+            exception_ptr error;
+            try {
+                if ( !image_ ) {
+                    image_ = RoutingImage::compile( propertiesFile_, props_, source_ );
+                }
+                routing = make_shared< Routing >( props_, image_ );
+            } catch ( ... ) {
+                error = current_exception();
             }
+            asio::post( context_, [this, routing, error] {
+                if ( error ) {
+                    rethrow_exception( error );
+                }
+                this->start( routing );
+            } );
+        } };
+    }
+
+    ThreadOptions threadOptions( char const* role ) const
+    {
+        return props_.value( "threads", json::object() ).value( role, json::object() ).get< ThreadOptions >();
+    }
+
+    static void configureBudgets( json const& props )
+    {
+        if ( !Allocations::enabled() ) {
+            logger.warning( "allocation budgets need a build with DSMQ_COUNT_ALLOCATIONS, ignoring them" );
+            return;
+        }
+
+        AllocationBudget::warmup( props.value( "warmup", uint64_t { 100 } ));
+        auto budgets = props.value( "budgets", json::object() );
+        for ( auto const& budget : budgets.items() ) {
+            if ( !AllocationBudget::limit( budget.key(), budget.value().get< int64_t >() )) {
+                logger.warning( "no allocation budget site named ", budget.key() );
+            }
+        }
+    }
+
+    void start( shared_ptr< Routing > const& routing )
+    {
+        StartupTimeline::mark( "routing tables built" );
+
+        routing_ = routing;
+        source_.clear();
+        dropTables( props_ );
+        subscribe( routing_->subscriptions() );
+        if ( sensorFilter_ ) {
+            scheduleSensorSweep();
+        }
+        if ( props_.count( "local" ) > 0 ) {
+            localApi_ = make_unique< LocalApi >( context_, props_.at( "local" ), [this]( auto const& zone, auto const& group, auto const& scene ) {
+                this->on_callScene( zone, group, scene );
+            } );
+        }
+        // zone sensor values are only asked for when there's a filter to publish them
+        dss::EventSubscriptions events { *this };
+        if ( !sensorFilter_ ) {
+            events.disable( dss::EventZoneSensorValue::name );
         }
-        dss_.subscribe< dss::EventCallScene >( [this]( auto event ) { this->on_callScene( move( event ) ); } );
+        dss_.subscribe( move( events ));
         dss_.eventLoop();
     }
 
-    void run()
+    // the tables come from the routing image, the JSON is only parsed in full when the image has to be compiled
+    static Configuration readProperties( string const& fileName )
     {
-        context_.run();
+        Configuration result;
+        result.image = RoutingImage::open( fileName, result.props, result.source );
+        return result;
+    }
+
+    // the tables live in the routing image once it is compiled
+    static void dropTables( json& props )
+    {
+        for ( auto const& key : { "zones", "groups", "scenes" } ) {
+            props.erase( key );
+        }
+    }
+
+    void publishSensorValue( unsigned zone, unsigned sensorType, double value )
+    {
+        auto targetZone = routing_->zones().ds2mq( zone );
+        if ( !targetZone ) {
+            return;
+        }
+        auto topic = ( boost::format( sensorTopicTemplate_ ) % *targetZone % sensorType ).str();
+        logger.debug( "forwarding sensor value ", value, " to topic ", topic );
+        mqtt_.publish( move( topic ), json( value ).dump() );
+    }
+
+    // held back and overdue sensor values go out from here, not only when the next value arrives
+    void scheduleSensorSweep()
+    {
+        sensorSweepTimer_.expires_after( sensorSweepInterval_ );
+        sensorSweepTimer_.async_wait( [this]( auto ec ) {
+            if ( ec != make_error_code( asio::error::operation_aborted )) {
+                sensorFilter_->sweep( Clock::now(), [this]( auto zone, auto sensorType, auto value ) {
+                    this->publishSensorValue( zone, sensorType, value );
+                } );
+                this->scheduleSensorSweep();
+            }
+        } );
+    }
+
+    void scheduleMetrics()
+    {
+        metricsTimer_.expires_after( metricsInterval_ );
+        metricsTimer_.async_wait( [this]( auto ec ) {
+            if ( ec != make_error_code( asio::error::operation_aborted )) {
+                this->reportMetrics();
+                this->scheduleMetrics();
+            }
+        } );
+    }
+
+    void reportMetrics()
+    {
+        Profiler::Scope scope { metricsSite };
+
+        if ( lagProbe_ ) {
+            for ( auto const& slowest : Profiler::top( profileTop_ )) {
+                logger.info( "slowest ", slowest.site, " handler took ", slowest.duration.count() / 1000.0, " ms" );
+            }
+        }
+
+        auto snapshot = Metrics::snapshot().dump();
+        logger.info( "metrics: ", snapshot );
+        if ( !metricsTopic_.empty() ) {
+            mqtt_.publish( metricsTopic_, move( snapshot ));
+        }
     }
 
-private:
     void subscribeReloadSignals()
     {
         reloadSignals_.async_wait( [this]( auto ec, int signal ) {
             if ( ec != make_error_code( asio::error::operation_aborted )) {
                 Logger::reopen();
+                this->reload();
                 this->subscribeReloadSignals();
             }
         } );
     }
 
-    string topicName( string const& zone, string const& group ) const
+    // reading and compiling the configuration happens on a thread of its own like at startup, only the swap to the
+    // new routing runs on the io thread
+    void reload()
     {
-        return ( boost::format( topicTemplate_ ) % zone % group ).str();
+        if ( !routing_ ) {
+            logger.warning( "startup still in progress, ignoring reload request" );
+            return;
+        }
+        if ( reloading_ ) {
+            logger.warning( "reload already in progress, ignoring reload request" );
+            return;
+        }
+        reloading_ = true;
+
+        logger.info( "reloading configuration from ", propertiesFile_ );
+
+        // the previous loader is done once it has posted its result
+        if ( routingLoader_.joinable() ) {
+            routingLoader_.join();
+        }
+        routingLoader_ = thread { [this, options = threadOptions( "routing" ), started = chrono::steady_clock::now()] {
+            Thread::configure( "routing", options );
+            shared_ptr< Routing > routing;
+            Configuration config;
+            string error;
+            try {
+                config = readProperties( propertiesFile_ );
+                if ( !config.image ) {
+                    config.image = RoutingImage::compile( propertiesFile_, config.props, config.source );
+                    dropTables( config.props );
+                }
+                routing = make_shared< Routing >( config.props, config.image );
+            } catch ( exception const& e ) {
+                error = e.what();
+            }
+            asio::post( context_, [this, routing, props = move( config.props ), image = move( config.image ), error, started]() mutable {
+                reloading_ = false;
+                if ( !routing ) {
+                    logger.error( "couldn't reload configuration, keeping current one: ", error );
+                    return;
+                }
+                this->applyReload( move( routing ), move( props ), move( image ), started );
+            } );
+        } };
+    }
+
+    void applyReload( shared_ptr< Routing > routing, json props, shared_ptr< RoutingImage const > image,
+            chrono::steady_clock::time_point started )
+    {
+        for ( auto const& section : { "MQTT", "dSS", "capture", "local", "threads", "sensors" } ) {
+            if ( props.value( section, json() ) != props_.value( section, json() )) {
+                logger.warning( "changes to ", section, " settings take effect after restarting" );
+            }
+        }
+
+        auto current = routing_->subscriptions();
+        auto next = routing->subscriptions();
+
+        Subscriptions added;
+        size_t removed {};
+        set_difference( next.begin(), next.end(), current.begin(), current.end(), inserter( added, added.end() ));
+        for ( auto const& subscription : current ) {
+            auto it = next.find( subscription.first );
+            if ( it == next.end() || it->second != subscription.second ) {
+                mqtt_.unsubscribe( subscription.first );
+                ++removed;
+            }
+        }
+
+        routing_ = move( routing );
+        props_ = move( props );
+        image_ = move( image );
+        subscribe( added );
+
+        auto elapsed = chrono::duration_cast< chrono::microseconds >( chrono::steady_clock::now() - started );
+        logger.info( "configuration reloaded in ", elapsed.count() / 1000.0, " ms, ", added.size(), " subscriptions added, ",
+                removed, " removed" );
+    }
+
+    void subscribe( Subscriptions const& subscriptions )
+    {
+        for ( auto const& subscription : subscriptions ) {
+            auto const& zone = get< 1 >( subscription.second );
+            auto const& group = get< 2 >( subscription.second );
+            switch ( get< 0 >( subscription.second )) {
+                case TopicKind::command:
+                    mqtt_.subscribe( subscription.first, [this, zone, group]( auto payload ) {
+                        this->on_callScene( zone, group, payload );
+                    } );
+                    break;
+
+                case TopicKind::stateQuery:
+                    mqtt_.subscribe( subscription.first, [this, zone, group]( auto ) {
+                        this->on_stateQuery( zone, group );
+                    } );
+                    break;
+
+                case TopicKind::zoneCommand:
+                    mqtt_.subscribe( subscription.first, [this, zone]( auto payload ) {
+                        this->on_zoneCallScene( zone, payload );
+                    } );
+                    break;
+            }
+        }
+    }
+
+    void updateState( string const& zone, string const& group, string const& scene )
+    {
+        // local clients see every activation, not only changes
+        if ( localApi_ ) {
+            localApi_->publish( zone, group, scene );
+        }
+
+        auto it = sceneStates_.find( make_pair( zone, group ));
+        if ( it != sceneStates_.end() ) {
+            if ( it->second == scene ) {
+                return;
+            }
+            it->second = scene;
+        } else {
+            sceneStates_.emplace( make_pair( zone, group ), scene );
+        }
+
+        if ( routing_->publishesState() ) {
+            mqtt_.publish( routing_->stateTopicName( zone, group ), scene, true );
+        }
+    }
+
+    void clearState( string const& zone, string const& group )
+    {
+        // an empty retained message removes the stale scene from the broker
+        if ( sceneStates_.erase( make_pair( zone, group )) > 0 && routing_->publishesState() ) {
+            mqtt_.publish( routing_->stateTopicName( zone, group ), string(), true );
+        }
+    }
+
+    string const* activeScene( string const& zone, string const& group ) const
+    {
+        auto it = sceneStates_.find( make_pair( zone, group ));
+        return it != sceneStates_.end() ? &it->second : nullptr;
     }
 
     void forwardMq( string const &zone, string const &group, string const &scene )
     {
-        auto topic = topicName( zone, group );
+        auto topic = routing_->topicName( zone, group );
         logger.info( "forwarding MQTT scene ", scene, " to topic ", topic );
+        StartupTimeline::finish( "first event forwarded" );
         mqtt_.publish( move( topic ), scene );
+        updateState( zone, group, scene );
+        eventsForwarded.increment();
+        suppressMqEcho( zone, group, scene );
+    }
+
+    // one message for all groups of a zone-wide scene: {"scene":"...","groups":["...",...]}
+    void forwardMqZone( string const& zone, StringList const& groups, string const& scene )
+    {
+        auto topic = routing_->aggregateTopicName( zone );
+        logger.info( "forwarding MQTT scene ", scene, " for ", groups.size(), " groups to topic ", topic );
+        StartupTimeline::finish( "first event forwarded" );
+        auto names = json::array();
+        for ( auto group : groups ) {
+            names.push_back( group.to_string() );
+        }
+        mqtt_.publish( move( topic ), json { { "scene", scene }, { "groups", move( names ) } }.dump() );
+        for ( auto group : groups ) {
+            updateState( zone, group.to_string(), scene );
+        }
+        eventsForwarded.increment();
 
+        // an empty group stands for the whole zone
+        suppressMqEcho( zone, string(), scene );
+    }
+
+    void suppressMqEcho( string const& zone, string const& group, string const& scene )
+    {
         auto it = forwardedMqScenes_.emplace( piecewise_construct, forward_as_tuple( zone, group, scene ),
                 forward_as_tuple( context_, chrono::milliseconds( 500 )));
         it->second.async_wait( [this, it]( auto ec ) {
@@ -190,10 +665,11 @@ private:
         } );
     }
 
-    void forwardDS( unsigned zone, unsigned group, unsigned scene )
+    void forwardDS( unsigned zone, unsigned group, unsigned scene, dss::Priority priority )
     {
         logger.info( "forwarding dSS scene ", scene, " to zone ", zone, ", group ", group );
-        dss_.callScene( zone, group, scene );
+        StartupTimeline::finish( "first event forwarded" );
+        dss_.callScene( zone, group, scene, priority );
 
         auto it = forwardedDSScenes_.emplace( piecewise_construct, forward_as_tuple( zone, group, scene ),
                 forward_as_tuple( context_, chrono::seconds( 5 )));
@@ -204,60 +680,161 @@ private:
         } );
     }
 
-    void on_callScene( dss::EventCallScene&& event )
+    // the scene is the MQTT payload as received, it is only copied when a command is held for coalescing
+    void on_callScene( string const& zone, string const& group, string_view scene )
     {
-        logger.debug( "received dSS callScene from zone ", event.zone(), ", group ", event.group(), ", scene ", event.scene() );
+        Profiler::Scope scope { callSceneSite };
+        AllocationBudget::Scope budget { mqttCommandBudget };
+        logger.debug( "received MQ callScene from zone ", zone, ", group ", group, ", scene ", scene );
 
-        auto range = forwardedDSScenes_.equal_range( forward_as_tuple( event.zone(), event.group(), event.scene()));
+        auto range = forwardedMqScenes_.equal_range( forward_as_tuple( zone, group, scene ));
         if ( range.first != range.second ) {
-            forwardedDSScenes_.erase( range.first );
+            DSMQ_TRACE3( mqtt_echo_suppressed, zone.c_str(), group.c_str(), scene.to_string().c_str() );
+            forwardedMqScenes_.erase( range.first );
             return;
         }
 
-        if ( auto targetZone = zoneTable_.ds2mq( event.zone())) {
-            if ( auto targetScene = zoneTable_.sceneDS2Mq( *targetZone, event.scene(), sceneTable_ )) {
-                if ( event.group() == 0 ) {
-                    for ( auto const &targetGroup : zoneTable_.groupsByMq( *targetZone, groupTable_ )) {
-                        forwardMq( *targetZone, targetGroup, *targetScene );
-                    }
-                } else if ( auto targetGroup = zoneTable_.groupDS2Mq( *targetZone, event.group(), groupTable_ )) {
-                    forwardMq( *targetZone, *targetGroup, *targetScene );
-                }
-            }
+        commandsReceived.increment();
+
+        auto window = routing_->coalesceWindow( zone );
+        if ( window == chrono::milliseconds::zero() ) {
+            dispatchCommand( zone, group, scene );
+            return;
+        }
+
+        // hold the first command of a burst for the window, later ones only replace the scene to be sent
+        auto it = pendingCommands_.find( make_pair( zone, group ));
+        if ( it != pendingCommands_.end() ) {
+            logger.debug( "coalescing scene ", it->second.scene, " for zone ", zone, ", group ", group, " into ", scene );
+            it->second.scene.assign( scene.data(), scene.size() );
+            it->second.coalesced = true;
+            commandsCoalesced.increment();
+            return;
         }
+
+        it = pendingCommands_.emplace( piecewise_construct, forward_as_tuple( zone, group ),
+                forward_as_tuple( context_, window, scene )).first;
+        it->second.timer.async_wait( [this, it]( auto ec ) {
+            if ( ec != make_error_code( asio::error::operation_aborted )) {
+                Profiler::Scope scope { coalesceSite };
+                AllocationBudget::Scope budget { mqttCommandBudget };
+                auto key = it->first;
+                auto scene = move( it->second.scene );
+                auto priority = it->second.coalesced ? dss::Priority::automation : dss::Priority::interactive;
+                pendingCommands_.erase( it );
+                this->dispatchCommand( key.first, key.second, scene, priority );
+            }
+        } );
     }
 
-    void on_callScene( string const& zone, string const& group, string const& scene )
+    void on_zoneCallScene( string const& zone, string_view payload )
     {
-        logger.debug( "received MQ callScene from zone ", zone, ", group ", group, ", scene ", scene );
+        string scene;
+        optional< vector< string > > groups;
+        try {
+            auto message = json::parse( payload.begin(), payload.end() );
+            scene = message.at( "scene" ).get< string >();
+            if ( message.count( "groups" ) > 0 ) {
+                groups = message.at( "groups" ).get< vector< string > >();
+            }
+        } catch ( exception const& e ) {
+            logger.warning( "ignoring malformed zone command for zone ", zone, ": ", e.what() );
+            return;
+        }
 
-        auto range = forwardedMqScenes_.equal_range( forward_as_tuple( zone, group, scene ));
+        logger.debug( "received MQ zone callScene from zone ", zone, ", scene ", scene );
+
+        auto range = forwardedMqScenes_.equal_range( forward_as_tuple( zone, string(), scene ));
         if ( range.first != range.second ) {
+            DSMQ_TRACE3( mqtt_echo_suppressed, zone.c_str(), "", scene.c_str() );
             forwardedMqScenes_.erase( range.first );
             return;
         }
 
-        auto targetZone = zoneTable_.mq2ds( zone );
-        auto targetGroup = groupTable_.mq2ds( group );
-        auto targetScene = zoneTable_.sceneMq2DS( zone, scene, sceneTable_ );
-        forwardDS( *targetZone, *targetGroup, *targetScene );
+        if ( groups ) {
+            for ( auto const& group : *groups ) {
+                on_callScene( zone, group, scene );
+            }
+            return;
+        }
+
+        // without a group list the whole zone is meant, which the dSS takes as a single call to group 0
+        commandsReceived.increment();
+        auto targetZone = routing_->zones().mq2ds( zone );
+        auto targetScene = routing_->zones().sceneMq2DS( zone, scene, routing_->scenes() );
+        if ( !targetZone || !targetScene ) {
+            logger.warning( "no dSS mapping for zone ", zone, ", scene ", scene );
+            return;
+        }
+        forwardDS( *targetZone, 0, *targetScene, dss::Priority::interactive );
+        commandsForwarded.increment();
     }
 
-    string topicTemplate_;
-    ZoneTable zoneTable_;
-    MappingTable groupTable_;
-    MappingTable sceneTable_;
+    void dispatchCommand( string const& zone, string const& group, string_view scene,
+            dss::Priority priority = dss::Priority::interactive )
+    {
+        if ( routing_->skipsActiveScenes() ) {
+            auto active = activeScene( zone, group );
+            if ( active && *active == scene ) {
+                logger.debug( "scene ", scene, " already active in zone ", zone, ", group ", group, ", not forwarding" );
+                return;
+            }
+        }
+
+        auto targetZone = routing_->zones().mq2ds( zone );
+        auto targetGroup = routing_->groups().mq2ds( group );
+        auto targetScene = routing_->zones().sceneMq2DS( zone, scene, routing_->scenes() );
+        DSMQ_TRACE4( mqtt_route, zone.c_str(), group.c_str(), scene.to_string().c_str(), targetZone && targetGroup && targetScene ? 1 : 0 );
+        if ( !targetZone || !targetGroup || !targetScene ) {
+            logger.warning( "no dSS mapping for zone ", zone, ", group ", group, ", scene ", scene );
+            return;
+        }
+        // the state follows once the dSS echoes the scene, a call that is held back or fails changes nothing
+        forwardDS( *targetZone, *targetGroup, *targetScene, priority );
+        commandsForwarded.increment();
+    }
+
+    void on_stateQuery( string const& zone, string const& group )
+    {
+        logger.debug( "received state query for zone ", zone, ", group ", group );
+
+        if ( auto active = activeScene( zone, group )) {
+            mqtt_.publish( routing_->stateTopicName( zone, group ), *active, true );
+        }
+    }
+
+    string propertiesFile_;
+    json props_;
+    shared_ptr< RoutingImage const > image_;
+    string source_;
+    chrono::seconds metricsInterval_ {};
+    string metricsTopic_;
+    size_t profileTop_ {};
+    shared_ptr< Routing > routing_;
     asio::io_context context_;
     ssl::context sslContext_ { ssl::context::sslv23_client };
     asio::signal_set reloadSignals_;
+    unique_ptr< Capture > capture_;
     mqtt::Client mqtt_;
     dss::Client dss_;
-    multimap< tuple< unsigned, unsigned, unsigned >, asio::steady_timer > forwardedDSScenes_;
-    multimap< tuple< string, string, string >, asio::steady_timer > forwardedMqScenes_;
+    unique_ptr< LocalApi > localApi_;
+    multimap< tuple< unsigned, unsigned, unsigned >, Timer > forwardedDSScenes_;
+    // looked up with the payload of a command as it was received
+    multimap< tuple< string, string, string >, Timer, less<> > forwardedMqScenes_;
+    map< pair< string, string >, string > sceneStates_;
+    map< pair< string, string >, PendingCommand > pendingCommands_;
+    Timer metricsTimer_ { context_ };
+    unique_ptr< LagProbe > lagProbe_;
+    thread routingLoader_;
+    bool reloading_ {};
+    string sensorTopicTemplate_;
+    unique_ptr< SensorFilter > sensorFilter_;
+    chrono::milliseconds sensorSweepInterval_ {};
+    Timer sensorSweepTimer_ { context_ };
 };
 
-Manager::Manager( json const& props )
-        : impl_ { make_unique< Impl >( props ) } {}
+Manager::Manager( string const& propertiesFile )
+        : impl_ { make_unique< Impl >( propertiesFile ) } {}
 
 Manager::~Manager() = default;
 
@@ -266,4 +843,4 @@ void Manager::run()
     impl_->run();
 }
 
-} // namespace dsmq
\ No newline at end of file
+} // namespace dsmq
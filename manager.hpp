@@ -2,8 +2,7 @@
 #define DS_MQTT_BRIDGE_MANAGER_HPP
 
 #include <memory>
-
-#include <nlohmann/json_fwd.hpp>
+#include <string>
 
 namespace dsmq {
 
@@ -12,7 +11,7 @@ class Manager
     class Impl;
 
 public:
-    explicit Manager( nlohmann::json const& props );
+    explicit Manager( std::string const& propertiesFile );
     ~Manager();
 
     void run();
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <nlohmann/json.hpp>
+
+#include "allocations.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace dsmq {
+
+namespace {
+
+struct Registry
+{
+    map< string, unique_ptr< Counter > > counters;
+    map< string, unique_ptr< Histogram > > histograms;
+    mutex access;
+};
+
+Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+template< typename Metric >
+Metric& lookup( map< string, unique_ptr< Metric > >& metrics, string const& name )
+{
+    auto& metric = metrics[ name ];
+    if ( !metric ) {
+        metric = make_unique< Metric >();
+    }
+    return *metric;
+}
+
+} // namespace
+
+void Histogram::record( chrono::nanoseconds duration )
+{
+    auto micros = static_cast< uint64_t >( max< int64_t >( chrono::duration_cast< chrono::microseconds >( duration ).count(), 0 ));
+
+    size_t index = 0;
+    while ( index + 1 < bucketCount && ( uint64_t { 1 } << index ) <= micros ) {
+        ++index;
+    }
+    buckets_[ index ].fetch_add( 1, memory_order_relaxed );
+    count_.fetch_add( 1, memory_order_relaxed );
+    sum_.fetch_add( micros, memory_order_relaxed );
+}
+
+uint64_t Histogram::quantile( double q ) const
+{
+    auto total = count();
+    if ( total == 0 ) {
+        return 0;
+    }
+
+    auto rank = static_cast< uint64_t >( q * total );
+    uint64_t seen {};
+    for ( size_t index = 0; index < bucketCount; ++index ) {
+        seen += bucket( index );
+        if ( seen > rank ) {
+            return uint64_t { 1 } << index;
+        }
+    }
+    return uint64_t { 1 } << ( bucketCount - 1 );
+}
+
+Counter& Metrics::counter( string const& name )
+{
+    auto& reg = registry();
+    lock_guard< mutex > lock { reg.access };
+    return lookup( reg.counters, name );
+}
+
+Histogram& Metrics::histogram( string const& name )
+{
+    auto& reg = registry();
+    lock_guard< mutex > lock { reg.access };
+    return lookup( reg.histograms, name );
+}
+
+json Metrics::snapshot()
+{
+    auto& reg = registry();
+    lock_guard< mutex > lock { reg.access };
+
+    json result = json::object();
+    for ( auto const& counter : reg.counters ) {
+        result[ counter.first ] = counter.second->value();
+    }
+    for ( auto const& histogram : reg.histograms ) {
+        auto const& h = *histogram.second;
+        result[ histogram.first ] = {
+                { "count", h.count() },
+                { "avg_us", h.count() > 0 ? h.sum() / h.count() : 0 },
+                { "p50_us", h.quantile( 0.5 ) },
+                { "p99_us", h.quantile( 0.99 ) }
+        };
+    }
+    if ( Allocations::enabled() ) {
+        result[ "heap.allocations" ] = Allocations::count();
+        result[ "heap.bytes" ] = Allocations::bytes();
+    }
+    return result;
+}
+
+} // namespace dsmq
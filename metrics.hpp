@@ -0,0 +1,69 @@
+#ifndef DS_MQTT_BRIDGE_METRICS_HPP
+#define DS_MQTT_BRIDGE_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <nlohmann/json_fwd.hpp>
+
+namespace dsmq {
+
+class Counter
+{
+public:
+    void increment( std::uint64_t value = 1 ) { value_.fetch_add( value, std::memory_order_relaxed ); }
+    std::uint64_t value() const { return value_.load( std::memory_order_relaxed ); }
+
+private:
+    std::atomic< std::uint64_t > value_ {};
+};
+
+/**
+ * class Histogram
+ *
+ * Durations in power of two microsecond buckets, the last bucket collects everything from about 4 seconds up.
+ */
+
+class Histogram
+{
+public:
+    static constexpr std::size_t bucketCount = 24;
+
+    void record( std::chrono::nanoseconds duration );
+
+    std::uint64_t count() const { return count_.load( std::memory_order_relaxed ); }
+    std::uint64_t sum() const { return sum_.load( std::memory_order_relaxed ); }
+    std::uint64_t bucket( std::size_t index ) const { return buckets_[ index ].load( std::memory_order_relaxed ); }
+
+    // upper bound in microseconds of the bucket containing the given quantile
+    std::uint64_t quantile( double q ) const;
+
+private:
+    std::array< std::atomic< std::uint64_t >, bucketCount > buckets_ {};
+    std::atomic< std::uint64_t > count_ {};
+    std::atomic< std::uint64_t > sum_ {};
+};
+
+/**
+ * class Metrics
+ *
+ * Process wide registry of named metrics. References returned by the registry stay valid for the lifetime of the
+ * process, so callers look them up once and keep them.
+ */
+
+class Metrics
+{
+public:
+    static Counter& counter( std::string const& name );
+    static Histogram& histogram( std::string const& name );
+
+    static nlohmann::json snapshot();
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_METRICS_HPP
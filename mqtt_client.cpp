@@ -1,19 +1,34 @@
 #include <cmath>
 #include <list>
 #include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
 
 #include <boost/asio/post.hpp>
-#include <boost/asio/steady_timer.hpp>
 #include <mosquitto.h>
 
+#include "capture.hpp"
+#include "clock.hpp"
 #include "logging.hpp"
+#include "metrics.hpp"
 #include "mqtt_client.hpp"
+#include "mqtt_payload.hpp"
+#include "profiler.hpp"
 #include "string.hpp"
+#include "thread.hpp"
+#include "timeline.hpp"
+#include "trace.hpp"
+
+#if defined( LIBMOSQUITTO_VERSION_NUMBER ) && LIBMOSQUITTO_VERSION_NUMBER >= 1006000
+#   define DSMQ_MQTT_V5
+#endif
 
 using namespace std;
+using namespace std::experimental;
 
 namespace asio = boost::asio;
 
@@ -22,20 +37,43 @@ namespace mqtt {
 
 static Logger logger( "mqtt_client" );
 
+static Profiler::Site& dispatchSite = Profiler::site( "mqtt.dispatch" );
+
+static Counter& aliasedPublishes = Metrics::counter( "mqtt.publish.aliased" );
+static Counter& resumedSessions = Metrics::counter( "mqtt.session.resumed" );
+
 class Client::Impl
 {
     using Lock = unique_lock< mutex >;
+    using Handler = function< void ( string_view payload ) >;
 
 public:
-    Impl( asio::io_context& context, Endpoint&& endpoint )
+    Impl( asio::io_context& context, Endpoint&& endpoint, Capture* capture, ThreadOptions&& threadOptions )
             : context_ { context }
             , endpoint_ { move( endpoint ) }
+            , capture_ { capture }
+            , threadOptions_ { move( threadOptions ) }
     {
         call_once( initialized, [] { mosquitto_lib_init(); } );
 
         mosq_ = mosquitto_new( endpoint_.clientId().c_str(), false, this );
+#if defined( DSMQ_MQTT_V5 )
+        if ( endpoint_.v5() ) {
+            mosquitto_int_option( mosq_, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5 );
+        }
+        mosquitto_connect_v5_callback_set(
+                mosq_, []( mosquitto*, void* obj, int rc, int flags, mosquitto_property const* props ) {
+                    uint16_t aliasMaximum {};
+                    mosquitto_property_read_int16( props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &aliasMaximum, false );
+                    static_cast< Impl* >( obj )->on_connect( rc, ( flags & 1 ) != 0, aliasMaximum );
+                } );
+#else
+        if ( endpoint_.v5() ) {
+            logger.warning( endpoint_, "libmosquitto is too old for MQTT v5, connecting with MQTT 3.1.1" );
+        }
         mosquitto_connect_callback_set(
-                mosq_, []( mosquitto*, void* obj, int rc ) { static_cast< Impl* >( obj )->on_connect( rc ); } );
+                mosq_, []( mosquitto*, void* obj, int rc ) { static_cast< Impl* >( obj )->on_connect( rc, false, 0 ); } );
+#endif
         mosquitto_disconnect_callback_set(
                 mosq_, []( mosquitto*, void* obj, int rc ) { static_cast< Impl* >( obj )->on_disconnect( rc ); } );
         mosquitto_message_callback_set(
@@ -44,38 +82,71 @@ public:
         if ( int rc = mosquitto_loop_start( mosq_ ) ) {
             throw runtime_error( str( "couldn't start mqtt communications thread: ", mosquitto_strerror( rc )));
         }
+        logger.info( endpoint_, "mqtt thread placement is pending until the first answer from the broker" );
 
         connect();
     }
 
-    void publish( string&& topic, string&& payload )
+    ~Impl()
+    {
+        if ( connector_.joinable() ) {
+            connector_.join();
+        }
+    }
+
+    void publish( string&& topic, string&& payload, bool retain )
     {
         Lock lock { mutex_ };
         if ( connected_ ) {
-            sendPublish( topic, payload );
+            sendPublish( topic, payload, retain );
         } else {
             logger.debug( endpoint_, "registering publication for ", topic );
-            publications_.emplace_back( move( topic ), move( payload ) );
+            DSMQ_TRACE1( mqtt_queued, topic.c_str() );
+            publications_.emplace_back( move( topic ), move( payload ), retain );
         }
     }
 
-    void subscribe( string&& topic, function< void ( string payload ) >&& handler )
+    void subscribe( string&& topic, Handler&& handler )
     {
         logger.debug( endpoint_, "registering subscription for ", topic );
 
         Lock lock { mutex_ };
-        auto subscription = subscriptions_.emplace( move( topic ), move( handler ) );
+        auto subscription = subscriptions_.emplace( move( topic ), make_shared< Handler >( move( handler )) );
         if ( connected_ ) {
             sendSubscribe( subscription->first );
         }
     }
 
+    void unsubscribe( string const& topic )
+    {
+        logger.debug( endpoint_, "removing subscriptions for ", topic );
+
+        Lock lock { mutex_ };
+        if ( subscriptions_.erase( topic ) > 0 && connected_ ) {
+            sendUnsubscribe( topic );
+        }
+    }
+
 private:
     void connect()
     {
         logger.info( endpoint_, "connecting to broker" );
 
-        if ( int rc = mosquitto_connect_async( mosq_, endpoint_.host().c_str(), endpoint_.port(), 60 ) ) {
+#if defined( DSMQ_MQTT_V5 )
+        if ( endpoint_.v5() && !connectPrepared_ ) {
+            startConnector();
+            return;
+        }
+#endif
+        auto rc = connectPrepared_
+                ? mosquitto_reconnect_async( mosq_ )
+                : mosquitto_connect_async( mosq_, endpoint_.host().c_str(), endpoint_.port(), 60 );
+        connected( rc );
+    }
+
+    void connected( int rc )
+    {
+        if ( rc ) {
             logger.error( endpoint_, "error initiating connection: ", mosquitto_strerror( rc ) );
             retryConnect();
         }
@@ -93,20 +164,81 @@ private:
 
         logger.info( endpoint_, "retrying connection in ", retryTimeout.count(), " seconds" );
 
-        auto timer = make_shared< asio::steady_timer >( context_, retryTimeout );
+        auto timer = make_shared< Timer >( context_, retryTimeout );
         timer->async_wait( [this, timer]( auto ec ) { if ( !ec ) this->connect(); } );
     }
 
-    void sendPublish( string const& topic, string const& payload )
+#if defined( DSMQ_MQTT_V5 )
+    // libmosquitto has no asynchronous v5 connect, so the first one blocks a thread of its own. libmosquitto keeps the
+    // connect properties, every later attempt goes through the asynchronous reconnect on the io thread.
+    void startConnector()
+    {
+        if ( connector_.joinable() ) {
+            connector_.join();
+        }
+        connector_ = thread { [this] {
+            mosquitto_property* props {};
+            if ( endpoint_.sessionExpiry() > 0 ) {
+                mosquitto_property_add_int32( &props, MQTT_PROP_SESSION_EXPIRY_INTERVAL, endpoint_.sessionExpiry() );
+            }
+            if ( endpoint_.receiveMaximum() > 0 ) {
+                mosquitto_property_add_int16( &props, MQTT_PROP_RECEIVE_MAXIMUM, endpoint_.receiveMaximum() );
+            }
+            auto rc = mosquitto_connect_bind_v5( mosq_, endpoint_.host().c_str(), endpoint_.port(), 60, nullptr, props );
+            mosquitto_property_free_all( &props );
+            asio::post( context_, [this, rc] {
+                // anything but invalid arguments got far enough for libmosquitto to keep host and properties
+                connectPrepared_ = rc != MOSQ_ERR_INVAL && rc != MOSQ_ERR_NOMEM;
+                this->connected( rc );
+            } );
+        } };
+    }
+#endif
+
+    void sendPublish( string const& topic, string const& payload, bool retain )
     {
         logger.debug( endpoint_, "publishing message to ", topic );
+        DSMQ_TRACE2( mqtt_publish, topic.c_str(), payload.length() );
+
+#if defined( DSMQ_MQTT_V5 )
+        if ( aliasMaximum_ > 0 ) {
+            sendAliasedPublish( topic, payload, retain );
+            return;
+        }
+#endif
 
-        if ( int rc = mosquitto_publish( mosq_, nullptr, topic.c_str(), payload.length(), payload.data(), 0, false )) {
+        if ( int rc = mosquitto_publish( mosq_, nullptr, topic.c_str(), payload.length(), payload.data(), 0, retain )) {
             logger.error( endpoint_, "error publishing to ", topic, ": ", mosquitto_strerror( rc ));
             // TODO
         }
     }
 
+#if defined( DSMQ_MQTT_V5 )
+    // our topic set is fixed, so the first topics published on a connection get the aliases the broker allows
+    void sendAliasedPublish( string const& topic, string const& payload, bool retain )
+    {
+        auto alias = aliases_.find( topic );
+        auto known = alias != aliases_.end();
+        if ( !known && aliases_.size() < aliasMaximum_ ) {
+            alias = aliases_.emplace( topic, static_cast< uint16_t >( aliases_.size() + 1 )).first;
+        }
+
+        mosquitto_property* props {};
+        if ( alias != aliases_.end() ) {
+            mosquitto_property_add_int16( &props, MQTT_PROP_TOPIC_ALIAS, alias->second );
+        }
+        // once the alias has been sent along with the topic, the topic can be left out
+        auto rc = mosquitto_publish_v5(
+                mosq_, nullptr, known ? nullptr : topic.c_str(), payload.length(), payload.data(), 0, retain, props );
+        mosquitto_property_free_all( &props );
+        if ( rc ) {
+            logger.error( endpoint_, "error publishing to ", topic, ": ", mosquitto_strerror( rc ));
+        } else if ( known ) {
+            aliasedPublishes.increment();
+        }
+    }
+#endif
+
     void sendSubscribe( string const& topic )
     {
         logger.info( endpoint_, "subscribing to topic ", topic );
@@ -114,27 +246,64 @@ private:
         if ( int rc = mosquitto_subscribe( mosq_, nullptr, topic.c_str(), 0 )) {
             logger.error( endpoint_, "error subscribing to ", topic, ": ", mosquitto_strerror( rc ));
             // TODO
+            return;
         }
+        sessionTopics_.insert( topic );
     }
 
-    void on_connect( int rc )
+    void sendUnsubscribe( string const& topic )
     {
+        logger.info( endpoint_, "unsubscribing from topic ", topic );
+
+        if ( int rc = mosquitto_unsubscribe( mosq_, nullptr, topic.c_str())) {
+            logger.error( endpoint_, "error unsubscribing from ", topic, ": ", mosquitto_strerror( rc ));
+        }
+        sessionTopics_.erase( topic );
+    }
+
+    void on_connect( int rc, bool sessionPresent, uint16_t aliasMaximum )
+    {
+        // libmosquitto doesn't hand out its network thread, so it is set up from the first callback running on it
+        if ( !threadConfigured_ ) {
+            Thread::configure( "mqtt", threadOptions_ );
+            threadConfigured_ = true;
+        }
+
         if ( rc ) {
             logger.error( endpoint_, "error establishing connection, retrying automatically: ", mosquitto_strerror( rc ));
+            DSMQ_TRACE1( mqtt_reconnect, rc );
             mosquitto_reconnect_async( mosq_ );
             return;
         }
 
         logger.info( endpoint_, "connection established successfully" );
+        StartupTimeline::mark( "MQTT connected" );
 
         Lock lock { mutex_ };
         connected_ = true;
         retries_ = 0;
+        aliasMaximum_ = endpoint_.topicAliases() ? aliasMaximum : uint16_t {};
+        aliases_.clear();
+
+        // a resumed session still holds the subscriptions, only what changed while disconnected is sent
+        if ( sessionPresent ) {
+            logger.info( endpoint_, "resuming session with ", sessionTopics_.size(), " subscriptions" );
+            resumedSessions.increment();
+        } else {
+            sessionTopics_.clear();
+        }
+        auto stale = sessionTopics_;
         for ( auto const& subscription : subscriptions_ ) {
-            sendSubscribe( subscription.first );
+            stale.erase( subscription.first );
+            if ( sessionTopics_.count( subscription.first ) == 0 ) {
+                sendSubscribe( subscription.first );
+            }
+        }
+        for ( auto const& topic : stale ) {
+            sendUnsubscribe( topic );
         }
         for ( auto const& publication : publications_ ) {
-            sendPublish( publication.first, publication.second );
+            sendPublish( get< 0 >( publication ), get< 1 >( publication ), get< 2 >( publication ));
         }
         publications_.clear();
     }
@@ -149,19 +318,27 @@ private:
 
         Lock lock( mutex_ );
         connected_ = false;
+        DSMQ_TRACE1( mqtt_reconnect, rc );
         mosquitto_reconnect_async( mosq_ );
     }
 
     void on_message( mosquitto_message const& message )
     {
-        auto payload = make_shared< string >(
-                static_cast< char const* >( message.payload ),
-                static_cast< size_t >( message.payloadlen ) );
+        DSMQ_TRACE2( mqtt_receive, message.topic, message.payloadlen );
+        if ( capture_ ) {
+            capture_->record( Capture::Source::mqttMessage, message.topic,
+                    { static_cast< char const* >( message.payload ), static_cast< size_t >( message.payloadlen ) } );
+        }
+
+        Payload payload { { static_cast< char const* >( message.payload ), static_cast< size_t >( message.payloadlen ) } };
 
         Lock lock { mutex_ };
         auto subscriptions = subscriptions_.equal_range( message.topic );
         for_each( subscriptions.first, subscriptions.second, [&]( auto const& subscription ) {
-            asio::post( context_, [payload, &subscription] { subscription.second( *payload ); } );
+            asio::post( context_, [payload, handler = subscription.second] {
+                Profiler::Scope scope { dispatchSite };
+                ( *handler )( payload.view() );
+            } );
         } );
     }
 
@@ -169,30 +346,43 @@ private:
 
     asio::io_context& context_;
     Endpoint endpoint_;
+    Capture* capture_;
+    ThreadOptions threadOptions_;
+    bool threadConfigured_ {};
+    bool connectPrepared_ {};
+    thread connector_;
     mosquitto* mosq_ {};
     bool connected_ {};
     size_t retries_ {};
-    list< pair< string, string > > publications_;
-    unordered_multimap< string, function< void ( string payload ) > > subscriptions_;
+    list< tuple< string, string, bool > > publications_;
+    unordered_multimap< string, shared_ptr< Handler > > subscriptions_;
+    set< string > sessionTopics_;
+    uint16_t aliasMaximum_ {};
+    unordered_map< string, uint16_t > aliases_;
     mutex mutex_;
 };
 
 once_flag Client::Impl::initialized;
 
-Client::Client( asio::io_context& context, Endpoint endpoint )
-        : impl_ { make_unique< Impl >( context, move( endpoint ) ) } {}
+Client::Client( asio::io_context& context, Endpoint endpoint, Capture* capture, ThreadOptions threadOptions )
+        : impl_ { make_unique< Impl >( context, move( endpoint ), capture, move( threadOptions )) } {}
 
 Client::~Client() = default;
 
-void Client::publish( string topic, string payload )
+void Client::publish( string topic, string payload, bool retain )
 {
-    impl_->publish( move( topic ), move( payload ));
+    impl_->publish( move( topic ), move( payload ), retain );
 }
 
-void Client::subscribe( string topic, function< void( string payload ) > handler )
+void Client::subscribe( string topic, function< void( string_view payload ) > handler )
 {
     impl_->subscribe( move( topic ), move( handler ));
 }
 
+void Client::unsubscribe( string const& topic )
+{
+    impl_->unsubscribe( topic );
+}
+
 } // namespace mqtt
 } // namespace dsmq
\ No newline at end of file
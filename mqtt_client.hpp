@@ -1,14 +1,20 @@
 #ifndef DS_MQTT_BRIDGE_MQTT_CLIENT_HPP
 #define DS_MQTT_BRIDGE_MQTT_CLIENT_HPP
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <experimental/string_view>
 
 #include <boost/asio/io_context.hpp>
 
 #include "mqtt_types.hpp"
+#include "thread.hpp"
 
 namespace dsmq {
+
+class Capture;
+
 namespace mqtt {
 
 class Client
@@ -16,11 +22,13 @@ class Client
     class Impl;
 
 public:
-    Client( boost::asio::io_context& context, Endpoint endpoint );
+    Client( boost::asio::io_context& context, Endpoint endpoint, Capture* capture, ThreadOptions threadOptions = {} );
     ~Client();
 
-    void publish( std::string topic, std::string payload );
-    void subscribe( std::string topic, std::function< void ( std::string payload ) > handler );
+    void publish( std::string topic, std::string payload, bool retain = false );
+    // handlers see a view of a shared payload that is only valid during the call
+    void subscribe( std::string topic, std::function< void ( std::experimental::string_view payload ) > handler );
+    void unsubscribe( std::string const& topic );
 
 private:
     std::unique_ptr< Impl > impl_;
@@ -0,0 +1,134 @@
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "mqtt_payload.hpp"
+
+using namespace std;
+using namespace std::experimental;
+
+namespace dsmq {
+namespace mqtt {
+
+struct Payload::Block
+{
+    atomic< size_t > references;
+    size_t size;
+    size_t capacity;
+
+    char* data() { return reinterpret_cast< char* >( this + 1 ); }
+};
+
+namespace {
+
+// payloads are created on the mosquitto thread and released on the io thread
+class BlockPool
+{
+public:
+    static constexpr size_t maxFree = 64;
+
+    ~BlockPool()
+    {
+        for ( auto block : free_ ) {
+            ::operator delete( block );
+        }
+    }
+
+    void* acquire( size_t size )
+    {
+        {
+            lock_guard< mutex > lock { mutex_ };
+            if ( !free_.empty() ) {
+                auto block = free_.back();
+                free_.pop_back();
+                return block;
+            }
+        }
+        return ::operator new( size );
+    }
+
+    void release( void* block )
+    {
+        {
+            lock_guard< mutex > lock { mutex_ };
+            if ( free_.size() < maxFree ) {
+                free_.push_back( block );
+                return;
+            }
+        }
+        ::operator delete( block );
+    }
+
+private:
+    vector< void* > free_;
+    mutex mutex_;
+};
+
+BlockPool& pool()
+{
+    static BlockPool instance;
+    return instance;
+}
+
+} // namespace
+
+Payload::Payload( string_view data )
+{
+    auto pooled = data.size() <= pooledCapacity;
+    auto capacity = pooled ? pooledCapacity : data.size();
+    auto memory = pooled ? pool().acquire( sizeof( Block ) + capacity ) : ::operator new( sizeof( Block ) + capacity );
+
+    block_ = new( memory ) Block { { 1 }, data.size(), capacity };
+    memcpy( block_->data(), data.data(), data.size() );
+}
+
+Payload::Payload( Payload const& other ) noexcept
+        : block_ { other.block_ }
+{
+    if ( block_ ) {
+        block_->references.fetch_add( 1, memory_order_relaxed );
+    }
+}
+
+Payload::Payload( Payload&& other ) noexcept
+        : block_ { other.block_ }
+{
+    other.block_ = nullptr;
+}
+
+Payload::~Payload()
+{
+    if ( !block_ || block_->references.fetch_sub( 1, memory_order_acq_rel ) != 1 ) {
+        return;
+    }
+
+    auto pooled = block_->capacity == pooledCapacity;
+    block_->~Block();
+    if ( pooled ) {
+        pool().release( block_ );
+    } else {
+        ::operator delete( block_ );
+    }
+}
+
+Payload& Payload::operator=( Payload other ) noexcept
+{
+    swap( block_, other.block_ );
+    return *this;
+}
+
+char const* Payload::data() const
+{
+    return block_ ? block_->data() : "";
+}
+
+size_t Payload::size() const
+{
+    return block_ ? block_->size : 0;
+}
+
+} // namespace mqtt
+} // namespace dsmq
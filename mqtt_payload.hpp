@@ -0,0 +1,43 @@
+#ifndef DS_MQTT_BRIDGE_MQTT_PAYLOAD_HPP
+#define DS_MQTT_BRIDGE_MQTT_PAYLOAD_HPP
+
+#include <cstddef>
+#include <experimental/string_view>
+
+namespace dsmq {
+namespace mqtt {
+
+/**
+ * class Payload
+ *
+ * Immutable, reference counted message payload. Copies share the buffer, which comes from a pool when it fits a
+ * typical scene payload.
+ */
+
+class Payload
+{
+    struct Block;
+
+public:
+    static constexpr std::size_t pooledCapacity = 256;
+
+    explicit Payload( std::experimental::string_view data );
+    Payload( Payload const& other ) noexcept;
+    Payload( Payload&& other ) noexcept;
+    ~Payload();
+
+    Payload& operator=( Payload other ) noexcept;
+
+    char const* data() const;
+    std::size_t size() const;
+
+    std::experimental::string_view view() const { return { data(), size() }; }
+
+private:
+    Block* block_;
+};
+
+} // namespace mqtt
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_MQTT_PAYLOAD_HPP
@@ -14,6 +14,10 @@ void from_json( nlohmann::json const& src, Endpoint& dst )
     dst.host_ = src.at( "host" );
     dst.port_ = src.at( "port" );
     dst.clientId_ = src.at( "clientId" );
+    dst.v5_ = src.value( "v5", dst.v5_ );
+    dst.sessionExpiry_ = src.value( "sessionExpiry", dst.sessionExpiry_ );
+    dst.receiveMaximum_ = src.value( "receiveMaximum", dst.receiveMaximum_ );
+    dst.topicAliases_ = src.value( "topicAliases", dst.topicAliases_ );
 }
 
 ostream& operator<<( ostream& os, Endpoint const& val )
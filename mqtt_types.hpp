@@ -1,6 +1,7 @@
 #ifndef DS_MQTT_BRIDGE_MQTT_TYPES_HPP
 #define DS_MQTT_BRIDGE_MQTT_TYPES_HPP
 
+#include <cstdint>
 #include <iosfwd>
 #include <string>
 
@@ -20,10 +21,20 @@ public:
     int port() const { return port_; }
     std::string const& clientId() const { return clientId_; }
 
+    // MQTT v5 session and flow control, only used when the broker is spoken to in v5
+    bool v5() const { return v5_; }
+    std::uint32_t sessionExpiry() const { return sessionExpiry_; }
+    std::uint16_t receiveMaximum() const { return receiveMaximum_; }
+    bool topicAliases() const { return topicAliases_; }
+
 private:
     std::string host_;
     int port_ {};
     std::string clientId_;
+    bool v5_ {};
+    std::uint32_t sessionExpiry_ {};
+    std::uint16_t receiveMaximum_ {};
+    bool topicAliases_ { true };
 };
 
 } // namespace mqtt
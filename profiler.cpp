@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <list>
+#include <mutex>
+
+#include "logging.hpp"
+#include "metrics.hpp"
+#include "profiler.hpp"
+#include "string.hpp"
+
+using namespace std;
+
+namespace asio = boost::asio;
+
+namespace dsmq {
+
+static Logger logger( "profiler" );
+
+namespace {
+
+struct Sites
+{
+    list< Profiler::Site > sites;
+    mutex access;
+};
+
+Sites& sites()
+{
+    static Sites instance;
+    return instance;
+}
+
+atomic< int64_t > slowThreshold { 50000 };
+
+} // namespace
+
+Profiler::Site::Site( char const* name )
+        : name_ { name }
+        , durations_ { Metrics::histogram( str( "handler.", name )) } {}
+
+Profiler::Scope::~Scope()
+{
+    auto elapsed = chrono::steady_clock::now() - started_;
+    site_.durations_.record( elapsed );
+
+    auto micros = static_cast< uint64_t >( chrono::duration_cast< chrono::microseconds >( elapsed ).count() );
+    auto slowest = site_.slowest_.load( memory_order_relaxed );
+    while ( micros > slowest && !site_.slowest_.compare_exchange_weak( slowest, micros, memory_order_relaxed )) {}
+
+    if ( static_cast< int64_t >( micros ) > slowThreshold.load( memory_order_relaxed )) {
+        logger.warning( "handler ", site_.name_, " blocked the io thread for ", micros / 1000.0, " ms" );
+    }
+}
+
+Profiler::Site& Profiler::site( char const* name )
+{
+    auto& registry = sites();
+    lock_guard< mutex > lock { registry.access };
+    auto it = find_if( registry.sites.begin(), registry.sites.end(), [name]( auto const& site ) {
+        return string( site.name() ) == name;
+    } );
+    if ( it != registry.sites.end() ) {
+        return *it;
+    }
+    registry.sites.emplace_back( name );
+    return registry.sites.back();
+}
+
+void Profiler::threshold( chrono::milliseconds threshold )
+{
+    slowThreshold = chrono::duration_cast< chrono::microseconds >( threshold ).count();
+}
+
+vector< Profiler::Slowest > Profiler::top( size_t count )
+{
+    auto& registry = sites();
+    lock_guard< mutex > lock { registry.access };
+
+    vector< Slowest > result;
+    for ( auto& site : registry.sites ) {
+        auto slowest = site.slowest_.exchange( 0, memory_order_relaxed );
+        if ( slowest > 0 ) {
+            result.push_back( { site.name(), chrono::microseconds( slowest ) } );
+        }
+    }
+    sort( result.begin(), result.end(), []( auto const& a, auto const& b ) { return a.duration > b.duration; } );
+    if ( result.size() > count ) {
+        result.resize( count );
+    }
+    return result;
+}
+
+LagProbe::LagProbe( asio::io_context& context, chrono::milliseconds interval )
+        : interval_ { interval }
+        , timer_ { context }
+        , lag_ { Metrics::histogram( "loop.lag" ) }
+{
+    schedule();
+}
+
+void LagProbe::schedule()
+{
+    timer_.expires_after( interval_ );
+    timer_.async_wait( [this]( auto ec ) {
+        if ( ec != make_error_code( asio::error::operation_aborted )) {
+            lag_.record( chrono::steady_clock::now() - timer_.expiry() );
+            this->schedule();
+        }
+    } );
+}
+
+} // namespace dsmq
@@ -0,0 +1,96 @@
+#ifndef DS_MQTT_BRIDGE_PROFILER_HPP
+#define DS_MQTT_BRIDGE_PROFILER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+namespace dsmq {
+
+class Histogram;
+
+/**
+ * class Profiler
+ *
+ * Times handlers on the io thread by call site. Durations go to the "handler.<site>" histograms, the slowest run per
+ * site is kept until the next report, and runs above the slow threshold are logged right away.
+ */
+
+class Profiler
+{
+public:
+    class Site
+    {
+        friend class Profiler;
+
+    public:
+        explicit Site( char const* name );
+
+        char const* name() const { return name_; }
+
+    private:
+        char const* name_;
+        Histogram& durations_;
+        std::atomic< std::uint64_t > slowest_ {};
+    };
+
+    class Scope
+    {
+    public:
+        explicit Scope( Site& site )
+                : site_ { site }
+                , started_ { std::chrono::steady_clock::now() } {}
+
+        Scope( Scope const& ) = delete;
+        ~Scope();
+
+    private:
+        Site& site_;
+        std::chrono::steady_clock::time_point started_;
+    };
+
+    struct Slowest
+    {
+        char const* site;
+        std::chrono::microseconds duration;
+    };
+
+    // sites are registered once and live for the rest of the process, call sites keep the reference in a static
+    static Site& site( char const* name );
+
+    static void threshold( std::chrono::milliseconds threshold );
+
+    // the slowest runs per site since the last call, slowest first
+    static std::vector< Slowest > top( std::size_t count );
+};
+
+/**
+ * class LagProbe
+ *
+ * Measures how late a periodic timer fires, which is how long ready handlers wait for the io thread. Recorded in the
+ * "loop.lag" histogram.
+ */
+
+class LagProbe
+{
+public:
+    LagProbe( boost::asio::io_context& context, std::chrono::milliseconds interval );
+    LagProbe( LagProbe const& ) = delete;
+
+private:
+    void schedule();
+
+    std::chrono::milliseconds interval_;
+    boost::asio::steady_timer timer_;
+    Histogram& lag_;
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_PROFILER_HPP
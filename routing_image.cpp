@@ -0,0 +1,491 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+
+#include <boost/crc.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <nlohmann/json.hpp>
+
+#include "logging.hpp"
+#include "routing_image.hpp"
+
+using namespace std;
+using namespace std::experimental;
+using namespace nlohmann;
+
+namespace ipc = boost::interprocess;
+
+namespace dsmq {
+
+static Logger logger( "routing_image" );
+
+namespace image {
+
+static constexpr char magic[ 8 ] = "DSMQRTE";
+static constexpr uint32_t byteOrder = 0x01020304;
+
+// all offsets are from the start of the image, string offsets from the start of the string data
+struct Header
+{
+    char magic[ 8 ];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t sourceSize;
+    uint32_t sourceCrc;
+    uint32_t imageCrc;      // everything after the header
+    uint32_t length;
+    uint32_t strings;
+    uint32_t zones;         // Table
+    uint32_t zoneEntries;   // Zone[], sorted by name
+    uint32_t zoneCount;
+    uint32_t groups;        // Table
+    uint32_t scenes;        // Table
+    uint32_t settings;      // string offset of the remaining settings as JSON
+    uint32_t settingsLength;
+    uint32_t reserved;
+};
+
+struct Ref
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct ByMq
+{
+    Ref mq;
+    uint32_t ds;
+};
+
+struct ByDs
+{
+    uint32_t ds;
+    Ref mq;
+};
+
+struct Table
+{
+    uint32_t mqs;           // Ref[] in configuration order
+    uint32_t mqCount;
+    uint32_t byMq;          // ByMq[], sorted by name
+    uint32_t byMqCount;
+    uint32_t byDs;          // ByDs[], sorted by id
+    uint32_t byDsCount;
+};
+
+struct Zone
+{
+    Ref name;
+    uint32_t hasGroups;
+    uint32_t groups;        // Ref[]
+    uint32_t groupCount;
+    uint32_t scenes;        // Table, zero if the zone doesn't override scenes
+};
+
+static_assert( sizeof( Header ) % 8 == 0, "image header must keep the following data aligned" );
+
+} // namespace image
+
+using namespace image;
+
+template< typename T >
+static T const* at( char const* base, uint32_t offset )
+{
+    return reinterpret_cast< T const* >( base + offset );
+}
+
+static string_view view( char const* strings, Ref const& ref )
+{
+    return { strings + ref.offset, ref.length };
+}
+
+static uint32_t crc32( char const* data, size_t size )
+{
+    boost::crc_32_type crc;
+    crc.process_bytes( data, size );
+    return crc.checksum();
+}
+
+/**
+ * StringList
+ */
+
+string_view StringList::iterator::operator*() const
+{
+    return view( strings_, *ref_ );
+}
+
+StringList::iterator& StringList::iterator::operator++()
+{
+    ++ref_;
+    return *this;
+}
+
+StringList::iterator StringList::begin() const
+{
+    return { refs_, strings_ };
+}
+
+StringList::iterator StringList::end() const
+{
+    return { refs_ + size_, strings_ };
+}
+
+/**
+ * MappingTable
+ */
+
+MappingTable::MappingTable( char const* base, Table const* table )
+        : base_ { base }
+        , strings_ { base + at< Header >( base, 0 )->strings }
+        , table_ { table } {}
+
+StringList MappingTable::mqs() const
+{
+    return table_ ? StringList { at< Ref >( base_, table_->mqs ), table_->mqCount, strings_ } : StringList {};
+}
+
+optional< unsigned > MappingTable::mq2ds( string_view val ) const
+{
+    if ( !table_ ) {
+        return nullopt;
+    }
+
+    auto first = at< ByMq >( base_, table_->byMq );
+    auto last = first + table_->byMqCount;
+    auto it = lower_bound( first, last, val, [this]( ByMq const& entry, string_view key ) { return view( strings_, entry.mq ) < key; } );
+    return it != last && view( strings_, it->mq ) == val ? optional< unsigned > { it->ds } : nullopt;
+}
+
+optional< string_view > MappingTable::ds2mq( unsigned val ) const
+{
+    if ( !table_ ) {
+        return nullopt;
+    }
+
+    auto first = at< ByDs >( base_, table_->byDs );
+    auto last = first + table_->byDsCount;
+    auto it = lower_bound( first, last, val, []( ByDs const& entry, unsigned key ) { return entry.ds < key; } );
+    return it != last && it->ds == val ? optional< string_view > { view( strings_, it->mq ) } : nullopt;
+}
+
+/**
+ * ZoneTable
+ */
+
+ZoneTable::ZoneTable( char const* base, Table const* table, Zone const* zones, size_t zoneCount )
+        : MappingTable { base, table }
+        , zones_ { zones }
+        , zoneCount_ { zoneCount } {}
+
+StringList ZoneTable::groupsByMq( string_view zone, MappingTable const& groupTable ) const
+{
+    auto entry = find( zone );
+    return entry && entry->hasGroups ? StringList { at< Ref >( base_, entry->groups ), entry->groupCount, strings_ } : groupTable.mqs();
+}
+
+optional< string_view > ZoneTable::groupDS2Mq( string_view zone, unsigned group, MappingTable const& groupTable ) const
+{
+    if ( auto result = groupTable.ds2mq( group )) {
+        auto groups = groupsByMq( zone, groupTable );
+        if ( std::find( groups.begin(), groups.end(), *result ) != groups.end() ) {
+            return result;
+        }
+    }
+    return nullopt;
+}
+
+optional< unsigned > ZoneTable::sceneMq2DS( string_view zone, string_view scene, MappingTable const& sceneTable ) const
+{
+    auto entry = find( zone );
+    if ( entry && entry->scenes ) {
+        if ( auto result = MappingTable { base_, at< Table >( base_, entry->scenes ) }.mq2ds( scene )) {
+            return result;
+        }
+    }
+    return sceneTable.mq2ds( scene );
+}
+
+optional< string_view > ZoneTable::sceneDS2Mq( string_view zone, unsigned scene, MappingTable const& sceneTable ) const
+{
+    auto entry = find( zone );
+    if ( entry && entry->scenes ) {
+        if ( auto result = MappingTable { base_, at< Table >( base_, entry->scenes ) }.ds2mq( scene )) {
+            return result;
+        }
+    }
+    return sceneTable.ds2mq( scene );
+}
+
+Zone const* ZoneTable::find( string_view zone ) const
+{
+    auto first = zones_;
+    auto last = zones_ + zoneCount_;
+    auto it = lower_bound( first, last, zone, [this]( Zone const& entry, string_view key ) { return view( strings_, entry.name ) < key; } );
+    return it != last && view( strings_, it->name ) == zone ? it : nullptr;
+}
+
+/**
+ * class ImageBuilder
+ *
+ * Lays out the image in one buffer, strings are collected separately, deduplicated and appended last.
+ */
+
+class ImageBuilder
+{
+public:
+    ImageBuilder()
+            : data_( sizeof( Header ), '\0' ) {}
+
+    Ref intern( string const& value )
+    {
+        auto it = stringOffsets_.find( value );
+        if ( it == stringOffsets_.end() ) {
+            it = stringOffsets_.emplace( value, static_cast< uint32_t >( strings_.size() )).first;
+            strings_.append( value );
+        }
+        return { it->second, static_cast< uint32_t >( value.size() ) };
+    }
+
+    template< typename T >
+    uint32_t append( vector< T > const& items )
+    {
+        auto offset = static_cast< uint32_t >( data_.size() );
+        data_.resize( data_.size() + items.size() * sizeof( T ));
+        if ( !items.empty() ) {
+            memcpy( &data_[ offset ], items.data(), items.size() * sizeof( T ));
+        }
+        return offset;
+    }
+
+    // the first entry wins for names or ids that occur more than once, like the hash maps this replaces
+    uint32_t table( json const& src )
+    {
+        vector< Ref > mqs;
+        vector< pair< string, ByMq > > byMq;
+        vector< ByDs > byDs;
+        for ( auto const& item : src ) {
+            auto mq = item.at( "MQ" ).get< string >();
+            auto ds = item.at( "dS" ).get< unsigned >();
+            auto ref = intern( mq );
+            mqs.push_back( ref );
+            byMq.emplace_back( move( mq ), ByMq { ref, ds } );
+            byDs.push_back( { ds, ref } );
+        }
+
+        stable_sort( byMq.begin(), byMq.end(), []( auto const& a, auto const& b ) { return a.first < b.first; } );
+        byMq.erase( unique( byMq.begin(), byMq.end(), []( auto const& a, auto const& b ) { return a.first == b.first; } ), byMq.end());
+        stable_sort( byDs.begin(), byDs.end(), []( auto const& a, auto const& b ) { return a.ds < b.ds; } );
+        byDs.erase( unique( byDs.begin(), byDs.end(), []( auto const& a, auto const& b ) { return a.ds == b.ds; } ), byDs.end());
+
+        vector< ByMq > sortedByMq;
+        sortedByMq.reserve( byMq.size() );
+        for ( auto const& entry : byMq ) {
+            sortedByMq.push_back( entry.second );
+        }
+
+        Table table {};
+        table.mqs = append( mqs );
+        table.mqCount = static_cast< uint32_t >( mqs.size() );
+        table.byMq = append( sortedByMq );
+        table.byMqCount = static_cast< uint32_t >( sortedByMq.size() );
+        table.byDs = append( byDs );
+        table.byDsCount = static_cast< uint32_t >( byDs.size() );
+        return append( vector< Table > { table } );
+    }
+
+    vector< char > build( json const& props, string const& source )
+    {
+        auto const& zones = props.at( "zones" );
+
+        Header header {};
+        memcpy( header.magic, magic, sizeof( magic ));
+        header.version = RoutingImage::version;
+        header.byteOrder = byteOrder;
+        header.sourceSize = source.size();
+        header.sourceCrc = crc32( source.data(), source.size() );
+        header.zones = table( zones );
+        header.groups = table( props.at( "groups" ));
+        header.scenes = table( props.at( "scenes" ));
+
+        vector< pair< string, Zone > > entries;
+        for ( auto const& item : zones ) {
+            auto hasGroups = item.count( "groups" ) > 0;
+            auto hasScenes = item.count( "scenes" ) > 0;
+            if ( !hasGroups && !hasScenes ) {
+                continue;
+            }
+
+            auto name = item.at( "MQ" ).get< string >();
+            Zone zone {};
+            zone.name = intern( name );
+            if ( hasGroups ) {
+                vector< Ref > groups;
+                for ( auto const& group : item.at( "groups" )) {
+                    groups.push_back( intern( group.get< string >() ));
+                }
+                zone.hasGroups = 1;
+                zone.groups = append( groups );
+                zone.groupCount = static_cast< uint32_t >( groups.size() );
+            }
+            if ( hasScenes ) {
+                zone.scenes = table( item.at( "scenes" ));
+            }
+            entries.emplace_back( move( name ), zone );
+        }
+        stable_sort( entries.begin(), entries.end(), []( auto const& a, auto const& b ) { return a.first < b.first; } );
+        entries.erase( unique( entries.begin(), entries.end(), []( auto const& a, auto const& b ) { return a.first == b.first; } ), entries.end());
+
+        vector< Zone > sortedZones;
+        for ( auto const& entry : entries ) {
+            sortedZones.push_back( entry.second );
+        }
+        header.zoneEntries = append( sortedZones );
+        header.zoneCount = static_cast< uint32_t >( sortedZones.size() );
+
+        auto settings = props;
+        for ( auto const& key : { "zones", "groups", "scenes" } ) {
+            settings.erase( key );
+        }
+        auto settingsRef = intern( settings.dump() );
+        header.settings = settingsRef.offset;
+        header.settingsLength = settingsRef.length;
+
+        header.strings = static_cast< uint32_t >( data_.size() );
+        data_.insert( data_.end(), strings_.begin(), strings_.end() );
+        header.length = static_cast< uint32_t >( data_.size() );
+        header.imageCrc = crc32( data_.data() + sizeof( Header ), data_.size() - sizeof( Header ));
+        memcpy( data_.data(), &header, sizeof( Header ));
+        return move( data_ );
+    }
+
+private:
+    vector< char > data_;
+    string strings_;
+    unordered_map< string, uint32_t > stringOffsets_;
+};
+
+/**
+ * RoutingImage
+ */
+
+class RoutingImage::Storage
+{
+public:
+    explicit Storage( string const& fileName )
+            : mapping_ { fileName.c_str(), ipc::read_only }
+            , region_ { mapping_, ipc::read_only } {}
+
+    explicit Storage( vector< char >&& data )
+            : data_ { move( data ) } {}
+
+    char const* data() const { return data_.empty() ? static_cast< char const* >( region_.get_address() ) : data_.data(); }
+    size_t size() const { return data_.empty() ? region_.get_size() : data_.size(); }
+
+private:
+    ipc::file_mapping mapping_;
+    ipc::mapped_region region_;
+    vector< char > data_;
+};
+
+static string readSource( string const& fileName )
+{
+    ifstream ifs { fileName, ios::in | ios::binary };
+    if ( !ifs ) {
+        throw system_error( errno, system_category(), "couldn't open " + fileName );
+    }
+    return { istreambuf_iterator< char >( ifs ), istreambuf_iterator< char >() };
+}
+
+static bool valid( char const* data, size_t size, string const& source )
+{
+    if ( size < sizeof( Header )) {
+        return false;
+    }
+
+    auto header = at< Header >( data, 0 );
+    return memcmp( header->magic, magic, sizeof( magic )) == 0
+            && header->version == RoutingImage::version
+            && header->byteOrder == byteOrder
+            && header->length == size
+            && header->sourceSize == source.size()
+            && header->sourceCrc == crc32( source.data(), source.size() )
+            && header->imageCrc == crc32( data + sizeof( Header ), size - sizeof( Header ));
+}
+
+shared_ptr< RoutingImage const > RoutingImage::open( string const& propertiesFile, json& props, string& source )
+{
+    source = readSource( propertiesFile );
+    auto cacheFile = propertiesFile + ".cache";
+
+    try {
+        auto storage = make_unique< Storage >( cacheFile );
+        if ( valid( storage->data(), storage->size(), source )) {
+            auto header = at< Header >( storage->data(), 0 );
+            auto settings = storage->data() + header->strings + header->settings;
+            props = json::parse( settings, settings + header->settingsLength );
+            logger.debug( "using routing image ", cacheFile );
+            return make_shared< RoutingImage >( move( storage ));
+        }
+        logger.info( "routing image ", cacheFile, " is outdated, recompiling" );
+    } catch ( ipc::interprocess_exception const& ) {
+        logger.info( "no routing image ", cacheFile, " yet, compiling" );
+    }
+
+    props = json::parse( source );
+    return nullptr;
+}
+
+shared_ptr< RoutingImage const > RoutingImage::compile( string const& propertiesFile, json const& props, string const& source )
+{
+    auto data = ImageBuilder().build( props, source );
+
+    auto cacheFile = propertiesFile + ".cache";
+    auto tempFile = cacheFile + ".tmp";
+    {
+        ofstream ofs { tempFile, ios::out | ios::trunc | ios::binary };
+        ofs.write( data.data(), data.size() );
+        if ( !ofs.flush() ) {
+            logger.warning( "couldn't write routing image ", cacheFile, ", keeping it in memory" );
+            return make_shared< RoutingImage >( make_unique< Storage >( move( data )));
+        }
+    }
+    if ( rename( tempFile.c_str(), cacheFile.c_str() ) != 0 ) {
+        logger.warning( "couldn't replace routing image ", cacheFile, ", keeping it in memory" );
+        remove( tempFile.c_str() );
+        return make_shared< RoutingImage >( make_unique< Storage >( move( data )));
+    }
+
+    logger.info( "compiled routing image ", cacheFile, " of ", data.size(), " bytes" );
+    return make_shared< RoutingImage >( make_unique< Storage >( cacheFile ));
+}
+
+RoutingImage::RoutingImage( unique_ptr< Storage > storage )
+        : storage_ { move( storage ) }
+        , data_ { storage_->data() } {}
+
+RoutingImage::~RoutingImage() = default;
+
+ZoneTable RoutingImage::zones() const
+{
+    auto header = at< Header >( data_, 0 );
+    return { data_, at< Table >( data_, header->zones ), at< Zone >( data_, header->zoneEntries ), header->zoneCount };
+}
+
+MappingTable RoutingImage::groups() const
+{
+    return { data_, at< Table >( data_, at< Header >( data_, 0 )->groups ) };
+}
+
+MappingTable RoutingImage::scenes() const
+{
+    return { data_, at< Table >( data_, at< Header >( data_, 0 )->scenes ) };
+}
+
+} // namespace dsmq
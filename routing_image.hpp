@@ -0,0 +1,156 @@
+#ifndef DS_MQTT_BRIDGE_ROUTING_IMAGE_HPP
+#define DS_MQTT_BRIDGE_ROUTING_IMAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+#include <experimental/optional>
+#include <experimental/string_view>
+
+#include <nlohmann/json_fwd.hpp>
+
+namespace dsmq {
+
+namespace image {
+
+struct Ref;
+struct Table;
+struct Zone;
+
+} // namespace image
+
+/**
+ * class StringList
+ *
+ * A list of strings stored in a routing image, iterated as string_views.
+ */
+
+class StringList
+{
+public:
+    class iterator : public std::iterator< std::forward_iterator_tag, std::experimental::string_view >
+    {
+    public:
+        iterator( image::Ref const* ref, char const* strings )
+                : ref_ { ref }
+                , strings_ { strings } {}
+
+        std::experimental::string_view operator*() const;
+        iterator& operator++();
+
+        bool operator==( iterator const& other ) const { return ref_ == other.ref_; }
+        bool operator!=( iterator const& other ) const { return ref_ != other.ref_; }
+
+    private:
+        image::Ref const* ref_;
+        char const* strings_;
+    };
+
+    StringList() = default;
+    StringList( image::Ref const* refs, std::size_t size, char const* strings )
+            : refs_ { refs }
+            , size_ { size }
+            , strings_ { strings } {}
+
+    iterator begin() const;
+    iterator end() const;
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+private:
+    image::Ref const* refs_ {};
+    std::size_t size_ {};
+    char const* strings_ {};
+};
+
+/**
+ * class MappingTable
+ *
+ * Two way mapping between MQTT names and dSS ids, looked up directly in a routing image.
+ */
+
+class MappingTable
+{
+public:
+    MappingTable() = default;
+    MappingTable( char const* base, image::Table const* table );
+
+    StringList mqs() const;
+
+    std::experimental::optional< unsigned > mq2ds( std::experimental::string_view val ) const;
+    std::experimental::optional< std::experimental::string_view > ds2mq( unsigned val ) const;
+
+protected:
+    char const* base_ {};
+    char const* strings_ {};
+    image::Table const* table_ {};
+};
+
+class ZoneTable : MappingTable
+{
+public:
+    ZoneTable() = default;
+    ZoneTable( char const* base, image::Table const* table, image::Zone const* zones, std::size_t zoneCount );
+
+    using MappingTable::mqs;
+    using MappingTable::mq2ds;
+    using MappingTable::ds2mq;
+
+    StringList groupsByMq( std::experimental::string_view zone, MappingTable const& groupTable ) const;
+    std::experimental::optional< std::experimental::string_view > groupDS2Mq(
+            std::experimental::string_view zone, unsigned group, MappingTable const& groupTable ) const;
+    std::experimental::optional< unsigned > sceneMq2DS(
+            std::experimental::string_view zone, std::experimental::string_view scene, MappingTable const& sceneTable ) const;
+    std::experimental::optional< std::experimental::string_view > sceneDS2Mq(
+            std::experimental::string_view zone, unsigned scene, MappingTable const& sceneTable ) const;
+
+private:
+    image::Zone const* find( std::experimental::string_view zone ) const;
+
+    image::Zone const* zones_ {};
+    std::size_t zoneCount_ {};
+};
+
+/**
+ * class RoutingImage
+ *
+ * The zone, group and scene tables of the configuration compiled into one flat, versioned image. The image is cached
+ * next to the configuration file as "<file>.cache" and memory mapped, it records the size and CRC-32 of the JSON it
+ * was compiled from and the CRC-32 of its own contents. The image uses the byte order of the machine that wrote it.
+ */
+
+class RoutingImage
+{
+    class Storage;
+
+public:
+    static constexpr std::uint32_t version = 1;
+
+    // maps the cached image if it matches the configuration file, then props are all settings except the tables;
+    // otherwise returns null, props is the whole parsed configuration and source the text it was parsed from
+    static std::shared_ptr< RoutingImage const > open( std::string const& propertiesFile, nlohmann::json& props, std::string& source );
+
+    // compiles the tables from the parsed configuration and writes the cache, or keeps the image in memory if the
+    // cache can't be written
+    static std::shared_ptr< RoutingImage const > compile(
+            std::string const& propertiesFile, nlohmann::json const& props, std::string const& source );
+
+    explicit RoutingImage( std::unique_ptr< Storage > storage );
+    RoutingImage( RoutingImage const& ) = delete;
+    ~RoutingImage();
+
+    ZoneTable zones() const;
+    MappingTable groups() const;
+    MappingTable scenes() const;
+
+private:
+    std::unique_ptr< Storage > storage_;
+    char const* data_;
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_ROUTING_IMAGE_HPP
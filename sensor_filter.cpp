@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "metrics.hpp"
+#include "sensor_filter.hpp"
+
+using namespace std;
+using namespace std::experimental;
+using namespace nlohmann;
+
+namespace dsmq {
+
+void from_json( json const& src, SensorFilterOptions& dst )
+{
+    dst.deadband_ = src.value( "deadband", dst.deadband_ );
+    dst.relativeDeadband_ = src.value( "relativeDeadband", dst.relativeDeadband_ );
+    dst.minInterval_ = chrono::milliseconds( src.value( "minInterval", dst.minInterval_.count() ));
+    dst.maxInterval_ = chrono::milliseconds( src.value( "maxInterval", dst.maxInterval_.count() ));
+    dst.average_ = chrono::milliseconds( src.value( "average", dst.average_.count() ));
+}
+
+SensorFilter::SensorFilter( json const& props )
+        : defaults_ { props.get< SensorFilterOptions >() }
+        , forwarded_ { Metrics::counter( "sensor.forwarded" ) }
+        , suppressed_ { Metrics::counter( "sensor.suppressed" ) }
+{
+    // per sensor type settings start from the section wide ones
+    auto sensorTypes = props.value( "sensorTypes", json::object() );
+    for ( auto const& item : sensorTypes.items() ) {
+        auto merged = props;
+        merged.update( item.value() );
+        sensorTypes_.emplace( stoul( item.key() ), merged.get< SensorFilterOptions >() );
+    }
+}
+
+optional< double > SensorFilter::filter( unsigned zone, unsigned sensorType, double value, Clock::time_point now )
+{
+    auto const& options = this->options( sensorType );
+    auto& state = this->state( zone, sensorType );
+    auto at = now.time_since_epoch().count();
+
+    auto candidate = value;
+    if ( options.average() > chrono::milliseconds::zero() ) {
+        if ( state.count == 0 ) {
+            state.windowStart = at;
+        }
+        state.sum += value;
+        ++state.count;
+        if ( Clock::duration( at - state.windowStart ) < options.average() ) {
+            suppressed_.increment();
+            return nullopt;
+        }
+        candidate = state.sum / state.count;
+        state.sum = 0;
+        state.count = 0;
+    }
+    return offer( options, state, candidate, at );
+}
+
+void SensorFilter::sweep( Clock::time_point now, function< void ( unsigned zone, unsigned sensorType, double value ) > const& publish )
+{
+    auto at = now.time_since_epoch().count();
+    for ( size_t i = 0; i < states_.size(); ++i ) {
+        auto zone = static_cast< unsigned >( keys_[ i ] >> 32 );
+        auto sensorType = static_cast< unsigned >( keys_[ i ] & 0xffffffff );
+        auto const& options = this->options( sensorType );
+        auto& state = states_[ i ];
+
+        if ( state.count > 0 && Clock::duration( at - state.windowStart ) >= options.average() ) {
+            auto candidate = state.sum / state.count;
+            state.sum = 0;
+            state.count = 0;
+            if ( auto value = offer( options, state, candidate, at )) {
+                publish( zone, sensorType, *value );
+                continue;
+            }
+        }
+
+        auto elapsed = Clock::duration( at - state.publishedAt );
+        if ( state.hasPending && elapsed >= options.minInterval() ) {
+            publish( zone, sensorType, this->publish( state, state.pending, at ));
+        } else if ( state.hasPublished && options.maxInterval() > chrono::milliseconds::zero() && elapsed >= options.maxInterval() ) {
+            publish( zone, sensorType, this->publish( state, state.published, at ));
+        }
+    }
+}
+
+optional< double > SensorFilter::offer( SensorFilterOptions const& options, State& state, double value, Clock::rep at )
+{
+    if ( state.hasPublished ) {
+        auto elapsed = Clock::duration( at - state.publishedAt );
+        auto change = fabs( value - state.published );
+        auto outsideBand = change > options.deadband() && change > options.relativeDeadband() * fabs( state.published );
+        auto overdue = options.maxInterval() > chrono::milliseconds::zero() && elapsed >= options.maxInterval();
+        if ( !outsideBand && !overdue ) {
+            // back within the band of what subscribers have, an earlier held back value is obsolete
+            state.hasPending = false;
+            suppressed_.increment();
+            return nullopt;
+        }
+        if ( elapsed < options.minInterval() ) {
+            state.pending = value;
+            state.hasPending = true;
+            suppressed_.increment();
+            return nullopt;
+        }
+    }
+    return publish( state, value, at );
+}
+
+double SensorFilter::publish( State& state, double value, Clock::rep at )
+{
+    state.published = value;
+    state.publishedAt = at;
+    state.hasPublished = true;
+    state.hasPending = false;
+    forwarded_.increment();
+    return value;
+}
+
+SensorFilterOptions const& SensorFilter::options( unsigned sensorType ) const
+{
+    auto it = sensorTypes_.find( sensorType );
+    return it != sensorTypes_.end() ? it->second : defaults_;
+}
+
+SensorFilter::State& SensorFilter::state( unsigned zone, unsigned sensorType )
+{
+    auto key = static_cast< uint64_t >( zone ) << 32 | sensorType;
+    auto it = lower_bound( keys_.begin(), keys_.end(), key );
+    auto index = static_cast< size_t >( it - keys_.begin() );
+    if ( it == keys_.end() || *it != key ) {
+        keys_.insert( it, key );
+        states_.insert( states_.begin() + index, State {} );
+    }
+    return states_[ index ];
+}
+
+} // namespace dsmq
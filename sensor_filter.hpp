@@ -0,0 +1,90 @@
+#ifndef DS_MQTT_BRIDGE_SENSOR_FILTER_HPP
+#define DS_MQTT_BRIDGE_SENSOR_FILTER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+#include <experimental/optional>
+
+#include <nlohmann/json_fwd.hpp>
+
+#include "clock.hpp"
+
+namespace dsmq {
+
+class Counter;
+
+class SensorFilterOptions
+{
+    friend void from_json( nlohmann::json const& src, SensorFilterOptions& dst );
+
+public:
+    // a value is published once it differs from the last published one by more than every band that is set
+    double deadband() const { return deadband_; }
+    double relativeDeadband() const { return relativeDeadband_; }
+    std::chrono::milliseconds minInterval() const { return minInterval_; }
+    // the last value is published again once this long has passed, even inside the deadband
+    std::chrono::milliseconds maxInterval() const { return maxInterval_; }
+    // values are averaged over this window before they are filtered
+    std::chrono::milliseconds average() const { return average_; }
+
+private:
+    double deadband_ {};
+    double relativeDeadband_ {};
+    std::chrono::milliseconds minInterval_ {};
+    std::chrono::milliseconds maxInterval_ {};
+    std::chrono::milliseconds average_ {};
+};
+
+/**
+ * class SensorFilter
+ *
+ * Deadband, rate limit and averaging stage for sensor values, keyed by zone and sensor type. The state of all sensors
+ * is kept in one flat array, found through a sorted key array. Values held back by the minimum interval, partly filled
+ * averaging windows and overdue republishes are flushed by sweep(). Passed and held back values count in
+ * "sensor.forwarded" and "sensor.suppressed".
+ */
+
+class SensorFilter
+{
+    struct State
+    {
+        double published;
+        Clock::rep publishedAt;
+        double sum;
+        std::uint32_t count;
+        Clock::rep windowStart;
+        double pending;
+        bool hasPublished;
+        bool hasPending;
+    };
+
+public:
+    explicit SensorFilter( nlohmann::json const& props );
+    SensorFilter( SensorFilter const& ) = delete;
+
+    // the value to publish, if any
+    std::experimental::optional< double > filter( unsigned zone, unsigned sensorType, double value, Clock::time_point now );
+
+    // publishes whatever has become due since the last values arrived, meant to run periodically
+    void sweep( Clock::time_point now, std::function< void ( unsigned zone, unsigned sensorType, double value ) > const& publish );
+
+private:
+    std::experimental::optional< double > offer( SensorFilterOptions const& options, State& state, double value, Clock::rep at );
+    double publish( State& state, double value, Clock::rep at );
+    SensorFilterOptions const& options( unsigned sensorType ) const;
+    State& state( unsigned zone, unsigned sensorType );
+
+    SensorFilterOptions defaults_;
+    std::map< unsigned, SensorFilterOptions > sensorTypes_;
+    std::vector< std::uint64_t > keys_;
+    std::vector< State > states_;
+    Counter& forwarded_;
+    Counter& suppressed_;
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_SENSOR_FILTER_HPP
@@ -0,0 +1,202 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "allocations.hpp"
+#include "bridge.hpp"
+#include "clock.hpp"
+#include "logging.hpp"
+#include "stand_ins.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace dsmq {
+namespace test {
+
+static constexpr char const* propertiesFile = "allocation_test.json";
+
+static constexpr size_t warmupRuns = 100;
+static constexpr size_t measuredRuns = 1000;
+
+// heap allocations a warmed up forwarding path may make per message. The goal is none, each one allowed is named
+// here; lower the budget when one of them goes away.
+
+// the topic copied for the MQTT client, the echo suppression entry and the handler of its expiry timer
+static constexpr uint64_t dssEventBudget = 3;
+// the retained state topic copied for the MQTT client
+static constexpr uint64_t dssEchoBudget = 1;
+// the echo suppression entry and the handler of its expiry timer
+static constexpr uint64_t mqttCommandBudget = 2;
+static constexpr uint64_t mqttEchoBudget = 0;
+// the echo suppression entry, its timer handler reuses the memory of the expired coalesce timer's
+static constexpr uint64_t coalescedCommandBudget = 1;
+
+// the window configured for the kitchen zone below
+static chrono::milliseconds const coalesceWindow { 50 };
+
+/**
+ * class Check
+ *
+ * The worst case of one forwarding step after warmup, held against its budget.
+ */
+
+class Check
+{
+public:
+    Check( char const* name, uint64_t budget )
+            : name_ { name }
+            , budget_ { budget } {}
+
+    void record( size_t run, uint64_t allocations )
+    {
+        if ( run >= warmupRuns && allocations > worst_ ) {
+            worst_ = allocations;
+        }
+    }
+
+    bool report() const
+    {
+        auto passed = worst_ <= budget_;
+        cout << ( passed ? "ok      " : "FAILED  " ) << name_ << ": " << worst_ << " heap allocations, budget is " << budget_
+                << endl;
+        return passed;
+    }
+
+private:
+    char const* name_;
+    uint64_t budget_;
+    uint64_t worst_ {};
+};
+
+static void writeProperties()
+{
+    ofstream( propertiesFile ) << R"({
+        "dSS": { "host": "localhost", "port": "8080", "apikey": "test" },
+        "MQTT": { "host": "localhost", "port": 1883, "clientId": "test" },
+        "topicTemplate": "dsmq/%1%/%2%",
+        "state": { "topicTemplate": "dsmq/%1%/%2%/state" },
+        "coalesce": { "zones": { "kitchen": 50 } },
+        "zones": [ { "MQ": "living", "dS": 1 }, { "MQ": "kitchen", "dS": 2 } ],
+        "groups": [ { "MQ": "light", "dS": 1 }, { "MQ": "shade", "dS": 2 } ],
+        "scenes": [ { "MQ": "on", "dS": 5 }, { "MQ": "off", "dS": 0 } ]
+    })";
+}
+
+static json callScene( unsigned zone, unsigned group, unsigned scene )
+{
+    return {
+            { "name", "callSceneBus" },
+            { "properties", {
+                    { "zoneID", to_string( zone ) },
+                    { "groupID", to_string( group ) },
+                    { "sceneID", to_string( scene ) } } } };
+}
+
+static bool run()
+{
+    if ( !Allocations::enabled() ) {
+        cout << "FAILED  allocations are only counted in a build with DSMQ_COUNT_ALLOCATIONS" << endl;
+        return false;
+    }
+
+    writeProperties();
+    Bridge bridge { propertiesFile };
+
+    auto& dss = DssStandIn::instance();
+    auto& mqtt = MqttStandIn::instance();
+    json const livingEvents[] = { callScene( 1, 1, 5 ), callScene( 1, 1, 0 ) };
+    json const kitchenEvents[] = { callScene( 2, 1, 5 ), callScene( 2, 1, 0 ) };
+    string const scenes[] = { "on", "off" };
+    string const livingTopic = "dsmq/living/light";
+    string const kitchenTopic = "dsmq/kitchen/light";
+    string const livingStateTopic = "dsmq/living/light/state";
+
+    Check dssEvent { "dSS event forwarded to MQTT", dssEventBudget };
+    Check mqttEcho { "MQTT echo of a forwarded event", mqttEchoBudget };
+    Check mqttCommand { "MQTT command forwarded to the dSS", mqttCommandBudget };
+    Check dssEcho { "dSS echo of a forwarded command", dssEchoBudget };
+    Check coalescedCommand { "coalesced MQTT command forwarded to the dSS", coalescedCommandBudget };
+
+    for ( size_t run = 0; run < warmupRuns + measuredRuns; ++run ) {
+        auto scene = run % 2;
+
+        // a scene called on the dSS goes out to MQTT, the broker sends it back to the bridge's own subscription
+        auto published = mqtt.published();
+        dssEvent.record( run, bridge.measure( [&] { dss.deliver( livingEvents[ scene ] ); } ));
+        if ( mqtt.published() == published ) {
+            cout << "FAILED  dSS event wasn't forwarded" << endl;
+            return false;
+        }
+        auto calls = dss.calls();
+        published = mqtt.published();
+        mqttEcho.record( run, bridge.measure( [&] { mqtt.deliver( livingTopic, scenes[ scene ] ); } ));
+        if ( dss.calls() != calls || mqtt.published() != published ) {
+            cout << "FAILED  MQTT echo wasn't suppressed" << endl;
+            return false;
+        }
+
+        // a command from MQTT is called on the dSS, which confirms it with the same scene event
+        mqttCommand.record( run, bridge.measure( [&] { mqtt.deliver( livingTopic, scenes[ 1 - scene ] ); } ));
+        if ( dss.calls() == calls ) {
+            cout << "FAILED  MQTT command wasn't forwarded" << endl;
+            return false;
+        }
+        calls = dss.calls();
+        published = mqtt.published();
+        dssEcho.record( run, bridge.measure( [&] { dss.deliver( livingEvents[ 1 - scene ] ); } ));
+        if ( dss.calls() != calls || mqtt.published() != published + 1 || mqtt.lastTopic() != livingStateTopic
+                || !mqtt.lastRetained() ) {
+            cout << "FAILED  dSS echo did more than update the state" << endl;
+            return false;
+        }
+
+        // a burst of commands is held for the coalesce window and sent as one
+        calls = dss.calls();
+        bridge.measure( [&] {
+            mqtt.deliver( kitchenTopic, scenes[ 1 - scene ] );
+            mqtt.deliver( kitchenTopic, scenes[ scene ] );
+        } );
+        coalescedCommand.record( run, bridge.wait( coalesceWindow ));
+        if ( dss.calls() != calls + 1 ) {
+            cout << "FAILED  coalesced MQTT commands weren't forwarded once" << endl;
+            return false;
+        }
+        bridge.measure( [&] { dss.deliver( kitchenEvents[ scene ] ); } );
+    }
+
+    auto passed = true;
+    for ( auto check : { &dssEvent, &mqttEcho, &mqttCommand, &dssEcho, &coalescedCommand } ) {
+        passed = check->report() && passed;
+    }
+    return passed;
+}
+
+} // namespace test
+} // namespace dsmq
+
+int main()
+{
+    using namespace dsmq;
+
+    static test::DiscardBuffer discardBuffer;
+    static ostream discard { &discardBuffer };
+    Logger::threshold( Logger::Level::info );
+    Logger::output( discard );
+
+    auto passed = false;
+    try {
+        passed = test::run();
+    } catch ( exception const& e ) {
+        cout << "FAILED  " << e.what() << endl;
+    }
+
+    remove( test::propertiesFile );
+    remove( ( string( test::propertiesFile ) + ".cache" ).c_str() );
+    return passed ? 0 : 1;
+}
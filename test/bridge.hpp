@@ -0,0 +1,88 @@
+#ifndef DS_MQTT_BRIDGE_TEST_BRIDGE_HPP
+#define DS_MQTT_BRIDGE_TEST_BRIDGE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+
+#include <boost/asio/post.hpp>
+
+#include "allocations.hpp"
+#include "clock.hpp"
+#include "manager.hpp"
+#include "stand_ins.hpp"
+
+namespace dsmq {
+namespace test {
+
+/**
+ * class DiscardBuffer
+ *
+ * Swallows the log. Messages are still formatted, so logging at info level is part of what the tests run through.
+ */
+
+class DiscardBuffer : public std::streambuf
+{
+protected:
+    int_type overflow( int_type ch ) override { return traits_type::not_eof( ch ); }
+    std::streamsize xsputn( char const*, std::streamsize count ) override { return count; }
+};
+
+/**
+ * class Bridge
+ *
+ * A manager running against the stand-ins in virtual time. Messages are handed in from handlers on the io thread, as
+ * the real clients do, so asio's per-thread handler memory is reused like in the bridge.
+ */
+
+class Bridge
+{
+public:
+    explicit Bridge( std::string const& propertiesFile )
+            : manager_ { propertiesFile }
+            , simulation_ { *DssStandIn::instance().context() }
+    {
+        // the routing tables are built on a thread of their own before the manager subscribes
+        for ( auto attempts = 0; !DssStandIn::instance().running(); ++attempts ) {
+            if ( attempts == 5000 ) {
+                throw std::runtime_error( "manager didn't start" );
+            }
+            simulation_.runFor( Clock::duration::zero() );
+            std::this_thread::sleep_for( std::chrono::milliseconds( 1 ));
+        }
+    }
+
+    // runs the action as a handler and returns the heap allocations it made
+    template< typename Action >
+    std::uint64_t measure( Action&& action )
+    {
+        std::uint64_t result {};
+        boost::asio::post( *DssStandIn::instance().context(), [&] {
+            auto started = Allocations::threadCount();
+            action();
+            result = Allocations::threadCount() - started;
+        } );
+        simulation_.runFor( Clock::duration::zero() );
+        return result;
+    }
+
+    // lets virtual time pass and returns the heap allocations made by the timers that expired meanwhile
+    std::uint64_t wait( Clock::duration duration )
+    {
+        auto started = Allocations::threadCount();
+        simulation_.runFor( duration );
+        return Allocations::threadCount() - started;
+    }
+
+private:
+    Manager manager_;
+    Simulation simulation_;
+};
+
+} // namespace test
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_TEST_BRIDGE_HPP
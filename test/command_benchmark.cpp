@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <malloc.h>
+
+#include <boost/asio/coroutine.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/write.hpp>
+#include <nlohmann/json.hpp>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include "dss_client.hpp"
+#include "logging.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace asio = boost::asio;
+namespace ssl = boost::asio::ssl;
+namespace http = boost::beast::http;
+
+using tcp = asio::ip::tcp;
+
+namespace dsmq {
+namespace test {
+
+// commands sent for each measurement, and the workers parked for the idle one
+static constexpr size_t latencyCommands = 2000;
+static constexpr size_t throughputCommands = 20000;
+static constexpr size_t idleWorkers = 1024;
+static constexpr size_t inFlightCommands = 256;
+static constexpr size_t switches = 1000000;
+
+// how long the fake dSS sits on a command while the in-flight memory is measured
+static chrono::milliseconds const holdTime { 500 };
+
+/**
+ * Memory of the process: heap in use, including blocks mapped on their own like large stacks, and resident set.
+ */
+
+struct Memory
+{
+    static Memory now()
+    {
+        Memory result;
+        auto info = mallinfo2();
+        result.heap = info.uordblks + info.hblkhd;
+        ifstream statm( "/proc/self/statm" );
+        size_t size {};
+        statm >> size >> result.resident;
+        result.resident *= 4096;
+        return result;
+    }
+
+    double heapPer( Memory const& before, size_t count ) const { return double( heap - before.heap ) / count; }
+    double residentPer( Memory const& before, size_t count ) const { return double( resident - before.resident ) / count; }
+
+    size_t heap {};
+    size_t resident {};
+};
+
+static chrono::nanoseconds threadCpuTime()
+{
+    timespec ts {};
+    clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts );
+    return chrono::seconds( ts.tv_sec ) + chrono::nanoseconds( ts.tv_nsec );
+}
+
+// the fake dSS gets a certificate made at startup, so no key material lives in the tree
+static void useSelfSignedCertificate( ssl::context& context )
+{
+    EVP_PKEY* key {};
+    auto keyContext = EVP_PKEY_CTX_new_id( EVP_PKEY_EC, nullptr );
+    if ( !keyContext || EVP_PKEY_keygen_init( keyContext ) <= 0
+            || EVP_PKEY_CTX_set_ec_paramgen_curve_nid( keyContext, NID_X9_62_prime256v1 ) <= 0
+            || EVP_PKEY_keygen( keyContext, &key ) <= 0 ) {
+        throw runtime_error( "couldn't generate a key" );
+    }
+    EVP_PKEY_CTX_free( keyContext );
+
+    auto certificate = X509_new();
+    X509_set_version( certificate, 2 );
+    ASN1_INTEGER_set( X509_get_serialNumber( certificate ), 1 );
+    X509_gmtime_adj( X509_getm_notBefore( certificate ), 0 );
+    X509_gmtime_adj( X509_getm_notAfter( certificate ), 3600 );
+    X509_set_pubkey( certificate, key );
+    auto name = X509_get_subject_name( certificate );
+    X509_NAME_add_entry_by_txt( name, "CN", MBSTRING_ASC, reinterpret_cast< unsigned char const* >( "localhost" ), -1, -1, 0 );
+    X509_set_issuer_name( certificate, name );
+    if ( X509_sign( certificate, key, EVP_sha256() ) <= 0
+            || SSL_CTX_use_certificate( context.native_handle(), certificate ) != 1
+            || SSL_CTX_use_PrivateKey( context.native_handle(), key ) != 1 ) {
+        throw runtime_error( "couldn't set up the certificate" );
+    }
+    X509_free( certificate );
+    EVP_PKEY_free( key );
+}
+
+/**
+ * class FakeDss
+ *
+ * Answers every request on its own thread, logins with a token and everything else with an empty success. Commands
+ * can be held for a while before they are answered, which keeps them in flight on the client.
+ */
+
+class FakeDss
+{
+    class Session : public enable_shared_from_this< Session >
+    {
+    public:
+        Session( FakeDss& dss, tcp::socket&& socket )
+                : dss_ { dss }
+                , stream_ { move( socket ), dss.sslContext_ }
+                , timer_ { dss.context_ } {}
+
+        void start()
+        {
+            stream_.async_handshake( ssl::stream_base::server, [self = shared_from_this()]( auto ec ) {
+                if ( !ec ) {
+                    self->read();
+                }
+            } );
+        }
+
+    private:
+        void read()
+        {
+            request_ = {};
+            http::async_read( stream_, buffer_, request_, [self = shared_from_this()]( auto ec, auto ) {
+                if ( !ec ) {
+                    self->answer();
+                }
+            } );
+        }
+
+        void answer()
+        {
+            auto target = request_.target();
+            auto login = target.find( "loginApplication" ) != target.npos;
+            auto command = target.find( "callScene" ) != target.npos;
+            if ( command ) {
+                ++dss_.received_;
+            }
+            timer_.expires_after( command ? dss_.hold_.load() : chrono::milliseconds::zero() );
+            timer_.async_wait( [self = shared_from_this(), login]( auto ) {
+                self->response_ = { http::status::ok, 11 };
+                self->response_.keep_alive( true );
+                self->response_.body() = login ? R"({"ok":true,"result":{"token":"benchmark"}})" : R"({"ok":true})";
+                self->response_.prepare_payload();
+                http::async_write( self->stream_, self->response_, [self]( auto ec, auto ) {
+                    if ( !ec ) {
+                        self->read();
+                    }
+                } );
+            } );
+        }
+
+        FakeDss& dss_;
+        ssl::stream< tcp::socket > stream_;
+        asio::steady_timer timer_;
+        boost::beast::flat_buffer buffer_;
+        http::request< http::string_body > request_;
+        http::response< http::string_body > response_;
+    };
+
+public:
+    FakeDss()
+    {
+        useSelfSignedCertificate( sslContext_ );
+        acceptor_.open( tcp::v4() );
+        acceptor_.set_option( tcp::acceptor::reuse_address( true ));
+        acceptor_.bind( { asio::ip::address_v4::loopback(), 0 } );
+        acceptor_.listen();
+        accept();
+        thread_ = thread { [this] { context_.run(); } };
+    }
+
+    ~FakeDss()
+    {
+        context_.stop();
+        thread_.join();
+    }
+
+    string port() const { return to_string( acceptor_.local_endpoint().port() ); }
+    size_t received() const { return received_; }
+    void hold( chrono::milliseconds hold ) { hold_ = hold; }
+
+private:
+    void accept()
+    {
+        acceptor_.async_accept( [this]( auto ec, tcp::socket socket ) {
+            if ( !ec ) {
+                socket.set_option( tcp::no_delay( true ));
+                make_shared< Session >( *this, move( socket ))->start();
+            }
+            this->accept();
+        } );
+    }
+
+    asio::io_context context_;
+    ssl::context sslContext_ { ssl::context::tls_server };
+    tcp::acceptor acceptor_ { context_ };
+    atomic< size_t > received_ {};
+    atomic< chrono::milliseconds > hold_ { chrono::milliseconds::zero() };
+    thread thread_;
+};
+
+/**
+ * class StacklessWaiter
+ *
+ * Parks on a timer and is woken up again, the way a command worker waits for the next command.
+ */
+
+class StacklessWaiter : public asio::coroutine
+{
+public:
+    StacklessWaiter( asio::steady_timer& timer, size_t& resumed )
+            : timer_ { timer }
+            , resumed_ { resumed } {}
+
+    void operator()( boost::system::error_code = {} )
+    {
+        BOOST_ASIO_CORO_REENTER( this ) {
+            while ( resumed_ < switches ) {
+                BOOST_ASIO_CORO_YIELD timer_.async_wait( [this]( boost::system::error_code ec ) { ( *this )( ec ); } );
+                ++resumed_;
+            }
+        }
+    }
+
+private:
+    asio::steady_timer& timer_;
+    size_t& resumed_;
+};
+
+// the time to wake up a parked coroutine and have it park again, start parks it the first time
+template< typename Start >
+static chrono::nanoseconds switchCost( Start&& start )
+{
+    asio::io_context context;
+    asio::steady_timer timer { context, asio::steady_timer::time_point::max() };
+    size_t resumed {};
+    start( context, timer, resumed );
+    context.poll();
+    auto started = chrono::steady_clock::now();
+    while ( resumed < switches ) {
+        timer.cancel_one();
+        context.poll();
+    }
+    return ( chrono::steady_clock::now() - started ) / switches;
+}
+
+/**
+ * class Bench
+ *
+ * A dSS client with the given number of workers, talking to the fake dSS as fast as its rate limit allows.
+ */
+
+class Bench
+{
+public:
+    Bench( FakeDss& dss, size_t workers )
+            : dss_ { dss }
+            , client_ { context_, sslContext_, dss::Endpoint { "127.0.0.1", dss.port(), "benchmark" }, options( workers ), nullptr }
+    {
+        client_.connect();
+        // the login is done once the first command goes through
+        call( 1 );
+    }
+
+    // runs the client until the fake dSS has received count more commands
+    void call( size_t count, function< void() > const& issue = {} )
+    {
+        auto target = dss_.received() + count;
+        if ( issue ) {
+            issue();
+        } else {
+            for ( size_t i = 0; i < count; ++i ) {
+                client_.callScene( 1, 1, 5 );
+            }
+        }
+        while ( dss_.received() < target ) {
+            context_.run_one_for( chrono::milliseconds( 10 ));
+        }
+    }
+
+    // lets the client read the answers to what it sent
+    void drain( chrono::milliseconds duration )
+    {
+        context_.run_for( duration );
+    }
+
+    dss::Client& client() { return client_; }
+
+private:
+    static dss::Options options( size_t workers )
+    {
+        return json {
+                { "workers", workers },
+                { "rateLimit", { { "rate", 1e9 }, { "burst", 1e9 } } },
+                { "deadlines", { { "initial", 5000 }, { "minimum", 5000 }, { "maximum", 5000 } } } }.get< dss::Options >();
+    }
+
+    FakeDss& dss_;
+    asio::io_context context_;
+    ssl::context sslContext_ { ssl::context::tls_client };
+    dss::Client client_;
+};
+
+static void run()
+{
+    auto stackful = switchCost( []( asio::io_context& context, asio::steady_timer& timer, size_t& resumed ) {
+        asio::spawn( context, [&timer, &resumed]( asio::yield_context yield ) {
+            boost::system::error_code ec;
+            while ( resumed < switches ) {
+                timer.async_wait( yield[ ec ] );
+                ++resumed;
+            }
+        } );
+    } );
+    unique_ptr< StacklessWaiter > waiter;
+    auto stackless = switchCost( [&waiter]( asio::io_context&, asio::steady_timer& timer, size_t& resumed ) {
+        waiter = make_unique< StacklessWaiter >( timer, resumed );
+        ( *waiter )();
+    } );
+    cout << "coroutine switch:      " << stackful.count() << " ns stackful, " << stackless.count() << " ns stackless" << endl;
+
+    FakeDss dss;
+
+    // one command after the other: how long until the dSS sees it, and what it costs the client
+    {
+        Bench bench { dss, 4 };
+        bench.call( 100 );
+        vector< chrono::nanoseconds > latencies;
+        auto cpu = threadCpuTime();
+        for ( size_t i = 0; i < latencyCommands; ++i ) {
+            auto started = chrono::steady_clock::now();
+            bench.call( 1 );
+            latencies.push_back( chrono::steady_clock::now() - started );
+            bench.drain( chrono::milliseconds( 0 ));
+        }
+        cpu = threadCpuTime() - cpu;
+        sort( latencies.begin(), latencies.end() );
+        cout << "sequential commands:   " << chrono::duration< double, micro >( latencies[ latencies.size() / 2 ] ).count()
+                << " us median, " << chrono::duration< double, micro >( latencies[ latencies.size() * 99 / 100 ] ).count()
+                << " us p99 until the dSS has it, " << chrono::duration< double, micro >( cpu ).count() / latencyCommands
+                << " us client CPU per command" << endl;
+    }
+
+    // a flood of commands through four workers
+    {
+        Bench bench { dss, 4 };
+        bench.call( 100 );
+        auto cpu = threadCpuTime();
+        auto started = chrono::steady_clock::now();
+        bench.call( throughputCommands );
+        auto elapsed = chrono::steady_clock::now() - started;
+        cpu = threadCpuTime() - cpu;
+        cout << "burst of " << throughputCommands << " commands: " << chrono::duration< double, micro >( elapsed ).count() / throughputCommands
+                << " us per command, " << chrono::duration< double, micro >( cpu ).count() / throughputCommands
+                << " us client CPU per command" << endl;
+    }
+
+    // what a parked worker costs
+    {
+        auto before = Memory::now();
+        Bench small { dss, 1 };
+        auto one = Memory::now();
+        Bench large { dss, 1 + idleWorkers };
+        auto many = Memory::now();
+        cout << "idle worker:           " << ( many.heap - one.heap - ( one.heap - before.heap )) / double( idleWorkers )
+                << " bytes heap, " << ( many.resident - one.resident - ( one.resident - before.resident )) / double( idleWorkers )
+                << " bytes resident" << endl;
+    }
+
+    // what a command costs while the dSS sits on it, with the worker sending it and its connection
+    {
+        auto before = Memory::now();
+        Bench bench { dss, inFlightCommands };
+        dss.hold( holdTime );
+        bench.call( inFlightCommands );
+        auto during = Memory::now();
+        dss.hold( chrono::milliseconds::zero() );
+        bench.drain( holdTime * 2 );
+        cout << "in-flight command:     " << during.heapPer( before, inFlightCommands ) << " bytes heap, "
+                << during.residentPer( before, inFlightCommands ) << " bytes resident" << endl;
+    }
+}
+
+} // namespace test
+} // namespace dsmq
+
+int main()
+{
+    using namespace dsmq;
+
+    Logger::threshold( Logger::Level::warning );
+    try {
+        test::run();
+    } catch ( exception const& e ) {
+        cout << "FAILED  " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
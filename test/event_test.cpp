@@ -0,0 +1,109 @@
+#include <exception>
+#include <iostream>
+#include <streambuf>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "dss_events.hpp"
+#include "logging.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace dsmq {
+namespace test {
+
+/**
+ * class DiscardBuffer
+ *
+ * Swallows the warnings about the malformed events handed in below.
+ */
+
+class DiscardBuffer : public streambuf
+{
+protected:
+    int_type overflow( int_type ch ) override { return traits_type::not_eof( ch ); }
+    streamsize xsputn( char const*, streamsize count ) override { return count; }
+};
+
+/**
+ * class Handler
+ *
+ * Counts the events that made it through decoding.
+ */
+
+class Handler
+{
+public:
+    void on_event( dss::EventCallScene&& event )
+    {
+        ++callScenes;
+        lastZone = event.zone();
+    }
+
+    void on_event( dss::EventZoneSensorValue&& ) { ++sensorValues; }
+
+    size_t callScenes {};
+    size_t sensorValues {};
+    unsigned lastZone {};
+};
+
+static json callScene( json zone )
+{
+    return {
+            { "name", "callSceneBus" },
+            { "properties", {
+                    { "zoneID", move( zone ) },
+                    { "groupID", "1" },
+                    { "sceneID", "5" } } } };
+}
+
+static bool check( char const* name, bool passed )
+{
+    cout << ( passed ? "ok      " : "FAILED  " ) << name << endl;
+    return passed;
+}
+
+static bool run()
+{
+    Handler handler;
+    dss::EventSubscriptions subscriptions { handler };
+    subscriptions.disable( dss::EventZoneSensorValue::name );
+
+    auto passed = true;
+    passed = check( "well formed event is dispatched", subscriptions.dispatch( callScene( "3" )) && handler.callScenes == 1 ) && passed;
+    passed = check( "event without a name is skipped", !subscriptions.dispatch( { { "properties", json::object() } } )) && passed;
+    passed = check( "event with a name that isn't a string is skipped", !subscriptions.dispatch( { { "name", 42 } } )) && passed;
+    passed = check( "event that isn't an object is skipped", !subscriptions.dispatch( json::array() )) && passed;
+    passed = check( "event without properties is skipped", !subscriptions.dispatch( { { "name", "callSceneBus" } } )) && passed;
+    passed = check( "event with a property of the wrong type is skipped", !subscriptions.dispatch( callScene( 3 ))) && passed;
+    passed = check( "event with a property that isn't a number is skipped", !subscriptions.dispatch( callScene( "kitchen" ))) && passed;
+    passed = check( "disabled event is skipped", !subscriptions.dispatch( {
+            { "name", "zoneSensorValue" },
+            { "properties", { { "zoneID", "1" }, { "sensorType", "9" }, { "sensorValueFloat", "21.5" } } } } )
+            && handler.sensorValues == 0 ) && passed;
+    passed = check( "events after malformed ones are dispatched", subscriptions.dispatch( callScene( "4" ))
+            && handler.callScenes == 2 && handler.lastZone == 4 ) && passed;
+    return passed;
+}
+
+} // namespace test
+} // namespace dsmq
+
+int main()
+{
+    using namespace dsmq;
+
+    static test::DiscardBuffer discardBuffer;
+    static ostream discard { &discardBuffer };
+    Logger::output( discard );
+
+    auto passed = false;
+    try {
+        passed = test::run();
+    } catch ( exception const& e ) {
+        cout << "FAILED  " << e.what() << endl;
+    }
+    return passed ? 0 : 1;
+}
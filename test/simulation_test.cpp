@@ -0,0 +1,221 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <nlohmann/json.hpp>
+
+#include "bridge.hpp"
+#include "clock.hpp"
+#include "logging.hpp"
+#include "stand_ins.hpp"
+
+using namespace std;
+using namespace nlohmann;
+
+namespace dsmq {
+namespace test {
+
+static constexpr char const* propertiesFile = "simulation_test.json";
+
+static constexpr size_t scenarios = 2000;
+
+// how long the manager holds on to what it forwarded to recognize the echo
+static Clock::duration const mqttEchoWindow = chrono::milliseconds( 500 );
+static Clock::duration const dssEchoWindow = chrono::seconds( 5 );
+
+// the window configured for the kitchen zone below
+static Clock::duration const coalesceWindow = chrono::milliseconds( 200 );
+
+// longer than any window, so each scenario starts from a quiet bridge
+static Clock::duration const settleTime = chrono::seconds( 10 );
+
+// echo delays on both sides of the windows, the broker answers in milliseconds while the dSS may take seconds
+static Clock::duration const mqttEchoDelays[] = {
+        chrono::milliseconds( 0 ), chrono::milliseconds( 20 ), chrono::milliseconds( 499 ),
+        chrono::milliseconds( 501 ), chrono::seconds( 2 ) };
+static Clock::duration const dssEchoDelays[] = {
+        chrono::milliseconds( 300 ), chrono::seconds( 2 ), chrono::milliseconds( 4999 ),
+        chrono::milliseconds( 5001 ), chrono::seconds( 8 ) };
+
+struct Zone
+{
+    unsigned dS;
+    char const* topic;
+    bool coalesced;
+};
+
+static Zone const zones[] = { { 1, "dsmq/living/light", false }, { 2, "dsmq/kitchen/light", true } };
+
+struct Scene
+{
+    unsigned dS;
+    char const* MQ;
+};
+
+static Scene const scenes[] = { { 5, "on" }, { 0, "off" }, { 17, "dim" } };
+
+/**
+ * class Tally
+ *
+ * How many times the bridge did what the traffic called for, out of how many chances it had.
+ */
+
+class Tally
+{
+public:
+    explicit Tally( char const* name )
+            : name_ { name } {}
+
+    void record( bool matched )
+    {
+        ++total_;
+        matched_ += matched ? 1 : 0;
+    }
+
+    bool report() const
+    {
+        auto passed = total_ > 0 && matched_ == total_;
+        cout << ( passed ? "ok      " : "FAILED  " ) << name_ << ": " << matched_ << " of " << total_ << endl;
+        return passed;
+    }
+
+private:
+    char const* name_;
+    size_t total_ {};
+    size_t matched_ {};
+};
+
+static void writeProperties()
+{
+    ofstream( propertiesFile ) << R"({
+        "dSS": { "host": "localhost", "port": "8080", "apikey": "test" },
+        "MQTT": { "host": "localhost", "port": 1883, "clientId": "test" },
+        "topicTemplate": "dsmq/%1%/%2%",
+        "state": { "topicTemplate": "dsmq/%1%/%2%/state" },
+        "coalesce": { "zones": { "kitchen": 200 } },
+        "zones": [ { "MQ": "living", "dS": 1 }, { "MQ": "kitchen", "dS": 2 } ],
+        "groups": [ { "MQ": "light", "dS": 1 } ],
+        "scenes": [ { "MQ": "on", "dS": 5 }, { "MQ": "off", "dS": 0 }, { "MQ": "dim", "dS": 17 } ]
+    })";
+}
+
+static json callScene( unsigned zone, unsigned scene )
+{
+    return {
+            { "name", "callSceneBus" },
+            { "properties", {
+                    { "zoneID", to_string( zone ) },
+                    { "groupID", "1" },
+                    { "sceneID", to_string( scene ) } } } };
+}
+
+template< typename T, size_t N >
+static T const& pick( minstd_rand& random, T const ( &choices )[ N ] )
+{
+    return choices[ random() % N ];
+}
+
+static bool run()
+{
+    writeProperties();
+    Bridge bridge { propertiesFile };
+
+    auto& dss = DssStandIn::instance();
+    auto& mqtt = MqttStandIn::instance();
+
+    // the same traffic on every run
+    minstd_rand random { 1 };
+
+    Tally forwardedEvents { "dSS events forwarded to MQTT" };
+    Tally mqttEchoesSuppressed { "MQTT echoes within 500 ms suppressed" };
+    Tally mqttEchoesForwarded { "MQTT messages after 500 ms forwarded to the dSS" };
+    Tally commandsForwarded { "MQTT commands forwarded to the dSS once, with the last scene" };
+    Tally commandsOnTime { "MQTT commands forwarded at once, or within the coalesce window" };
+    Tally dssEchoesSuppressed { "dSS echoes within 5 s suppressed" };
+    Tally dssEchoesForwarded { "dSS events after 5 s forwarded to MQTT" };
+
+    for ( size_t scenario = 0; scenario < scenarios; ++scenario ) {
+        auto const& zone = pick( random, zones );
+
+        if ( random() % 2 == 0 ) {
+            // a scene called on the dSS goes out to MQTT and the broker may send it back to the bridge
+            auto const& scene = pick( random, scenes );
+            auto published = mqtt.published( zone.topic );
+            bridge.measure( [&] { dss.deliver( callScene( zone.dS, scene.dS )); } );
+            forwardedEvents.record( mqtt.published( zone.topic ) == published + 1 );
+
+            auto delay = pick( random, mqttEchoDelays );
+            bridge.wait( delay );
+            auto calls = dss.calls();
+            bridge.measure( [&] { mqtt.deliver( zone.topic, scene.MQ ); } );
+            bridge.wait( coalesceWindow );
+            if ( delay < mqttEchoWindow ) {
+                mqttEchoesSuppressed.record( dss.calls() == calls );
+            } else {
+                mqttEchoesForwarded.record( dss.calls() == calls + 1 );
+            }
+        } else {
+            // a command from MQTT, in a coalesced zone possibly a burst of them, and the dSS confirming it later
+            auto started = Clock::now();
+            auto calls = dss.calls();
+            auto burst = zone.coalesced ? 1 + random() % 3 : 1;
+            Scene const* scene {};
+            for ( size_t i = 0; i < burst; ++i ) {
+                if ( i > 0 ) {
+                    bridge.wait( chrono::milliseconds( random() % 50 ));
+                }
+                scene = &pick( random, scenes );
+                bridge.measure( [&] { mqtt.deliver( zone.topic, scene->MQ ); } );
+            }
+            bridge.wait( coalesceWindow );
+            commandsForwarded.record( dss.calls() == calls + 1 && dss.lastCall() == make_tuple( zone.dS, 1u, scene->dS ));
+            auto delay = dss.lastCallTime() - started;
+            commandsOnTime.record( zone.coalesced ? delay <= coalesceWindow : delay == Clock::duration::zero() );
+
+            auto echoDelay = pick( random, dssEchoDelays );
+            bridge.wait( echoDelay - ( Clock::now() - dss.lastCallTime() ));
+            auto published = mqtt.published( zone.topic );
+            bridge.measure( [&] { dss.deliver( callScene( zone.dS, scene->dS )); } );
+            if ( echoDelay < dssEchoWindow ) {
+                dssEchoesSuppressed.record( mqtt.published( zone.topic ) == published );
+            } else {
+                dssEchoesForwarded.record( mqtt.published( zone.topic ) == published + 1 );
+            }
+        }
+
+        bridge.wait( settleTime );
+    }
+
+    auto passed = true;
+    for ( auto tally : { &forwardedEvents, &mqttEchoesSuppressed, &mqttEchoesForwarded, &commandsForwarded, &commandsOnTime,
+            &dssEchoesSuppressed, &dssEchoesForwarded } ) {
+        passed = tally->report() && passed;
+    }
+    return passed;
+}
+
+} // namespace test
+} // namespace dsmq
+
+int main()
+{
+    using namespace dsmq;
+
+    static test::DiscardBuffer discardBuffer;
+    static ostream discard { &discardBuffer };
+    Logger::output( discard );
+
+    auto passed = false;
+    try {
+        passed = test::run();
+    } catch ( exception const& e ) {
+        cout << "FAILED  " << e.what() << endl;
+    }
+
+    remove( test::propertiesFile );
+    remove( ( string( test::propertiesFile ) + ".cache" ).c_str() );
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include <cstring>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+
+#include "dss_client.hpp"
+#include "mqtt_client.hpp"
+#include "stand_ins.hpp"
+
+using namespace std;
+using namespace std::experimental;
+using namespace nlohmann;
+
+namespace asio = boost::asio;
+namespace ssl = boost::asio::ssl;
+
+namespace dsmq {
+namespace test {
+
+DssStandIn& DssStandIn::instance()
+{
+    static DssStandIn instance;
+    return instance;
+}
+
+bool DssStandIn::deliver( json const& event )
+{
+    return subscriptions_ && subscriptions_->dispatch( event );
+}
+
+void DssStandIn::subscribe( dss::EventSubscriptions&& subscriptions )
+{
+    subscriptions_.emplace( move( subscriptions ));
+}
+
+void DssStandIn::callScene( unsigned zone, unsigned group, unsigned scene )
+{
+    lastCall_ = make_tuple( zone, group, scene );
+    lastCallTime_ = Clock::now();
+    ++calls_;
+}
+
+MqttStandIn& MqttStandIn::instance()
+{
+    static MqttStandIn instance;
+    return instance;
+}
+
+bool MqttStandIn::deliver( string const& topic, string_view payload )
+{
+    auto it = subscriptions_.find( topic );
+    if ( it == subscriptions_.end() ) {
+        return false;
+    }
+    it->second( payload );
+    return true;
+}
+
+size_t MqttStandIn::published( string const& topic ) const
+{
+    auto it = publishedByTopic_.find( topic );
+    return it != publishedByTopic_.end() ? it->second : 0;
+}
+
+void MqttStandIn::publish( string&& topic, string&& payload, bool retain )
+{
+    ++publishedByTopic_[ topic ];
+    lastTopic_ = move( topic );
+    lastPayload_ = move( payload );
+    lastRetained_ = retain;
+    ++published_;
+}
+
+void MqttStandIn::subscribe( string&& topic, Handler&& handler )
+{
+    subscriptions_[ move( topic ) ] = move( handler );
+}
+
+void MqttStandIn::unsubscribe( string const& topic )
+{
+    subscriptions_.erase( topic );
+}
+
+} // namespace test
+
+// the clients the manager is built against, linked in place of dss_client.cpp and mqtt_client.cpp
+
+namespace dss {
+
+class Client::Impl {};
+
+Client::Client( asio::io_context& context, ssl::context&, Endpoint, Options, Capture* )
+{
+    test::DssStandIn::instance().attach( context );
+}
+
+Client::~Client() = default;
+
+void Client::subscribe( EventSubscriptions subscriptions )
+{
+    test::DssStandIn::instance().subscribe( move( subscriptions ));
+}
+
+void Client::connect() {}
+
+void Client::eventLoop()
+{
+    test::DssStandIn::instance().start();
+}
+
+void Client::callScene( unsigned zone, unsigned group, unsigned scene, Priority )
+{
+    test::DssStandIn::instance().callScene( zone, group, scene );
+}
+
+} // namespace dss
+
+namespace mqtt {
+
+class Client::Impl {};
+
+Client::Client( asio::io_context&, Endpoint, Capture*, ThreadOptions ) {}
+
+Client::~Client() = default;
+
+void Client::publish( string topic, string payload, bool retain )
+{
+    test::MqttStandIn::instance().publish( move( topic ), move( payload ), retain );
+}
+
+void Client::subscribe( string topic, function< void( string_view payload ) > handler )
+{
+    test::MqttStandIn::instance().subscribe( move( topic ), move( handler ));
+}
+
+void Client::unsubscribe( string const& topic )
+{
+    test::MqttStandIn::instance().unsubscribe( topic );
+}
+
+} // namespace mqtt
+} // namespace dsmq
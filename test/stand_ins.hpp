@@ -0,0 +1,97 @@
+#ifndef DS_MQTT_BRIDGE_TEST_STAND_INS_HPP
+#define DS_MQTT_BRIDGE_TEST_STAND_INS_HPP
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <tuple>
+#include <experimental/optional>
+#include <experimental/string_view>
+
+#include <boost/asio/io_context.hpp>
+#include <nlohmann/json_fwd.hpp>
+
+#include "clock.hpp"
+#include "dss_events.hpp"
+
+namespace dsmq {
+namespace test {
+
+/**
+ * class DssStandIn
+ *
+ * Takes the place of the dSS client in tests. The manager subscribes to it as to the real client, the test hands in
+ * decoded events and scene calls are only recorded, with the time they were made. There is one per process, like the one dSS the bridge talks to.
+ */
+
+class DssStandIn
+{
+public:
+    static DssStandIn& instance();
+
+    // the context of the manager under test, set once its client is constructed
+    boost::asio::io_context* context() const { return context_; }
+    bool running() const { return running_; }
+
+    // passes the event to the subscribed handler, returns false if nobody handles it or it couldn't be decoded
+    bool deliver( nlohmann::json const& event );
+
+    std::size_t calls() const { return calls_; }
+    std::tuple< unsigned, unsigned, unsigned > const& lastCall() const { return lastCall_; }
+    Clock::time_point lastCallTime() const { return lastCallTime_; }
+
+    void attach( boost::asio::io_context& context ) { context_ = &context; }
+    void subscribe( dss::EventSubscriptions&& subscriptions );
+    void start() { running_ = true; }
+    void callScene( unsigned zone, unsigned group, unsigned scene );
+
+private:
+    boost::asio::io_context* context_ {};
+    bool running_ {};
+    std::experimental::optional< dss::EventSubscriptions > subscriptions_;
+    std::size_t calls_ {};
+    std::tuple< unsigned, unsigned, unsigned > lastCall_ {};
+    Clock::time_point lastCallTime_ {};
+};
+
+/**
+ * class MqttStandIn
+ *
+ * Takes the place of the MQTT client in tests. Subscriptions are kept by exact topic, the test delivers messages to
+ * them. The last message published is kept for inspection and publishes are counted per topic.
+ */
+
+class MqttStandIn
+{
+public:
+    using Handler = std::function< void ( std::experimental::string_view payload ) >;
+
+    static MqttStandIn& instance();
+
+    // passes the payload to the subscriber of the topic, returns false if there is none
+    bool deliver( std::string const& topic, std::experimental::string_view payload );
+
+    std::size_t published() const { return published_; }
+    std::size_t published( std::string const& topic ) const;
+    std::string const& lastTopic() const { return lastTopic_; }
+    std::string const& lastPayload() const { return lastPayload_; }
+    bool lastRetained() const { return lastRetained_; }
+
+    void publish( std::string&& topic, std::string&& payload, bool retain );
+    void subscribe( std::string&& topic, Handler&& handler );
+    void unsubscribe( std::string const& topic );
+
+private:
+    std::map< std::string, Handler > subscriptions_;
+    std::map< std::string, std::size_t > publishedByTopic_;
+    std::size_t published_ {};
+    std::string lastTopic_;
+    std::string lastPayload_;
+    bool lastRetained_ {};
+};
+
+} // namespace test
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_TEST_STAND_INS_HPP
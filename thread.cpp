@@ -0,0 +1,141 @@
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#if defined( __linux__ )
+#   include <pthread.h>
+#   include <sched.h>
+#   include <sys/resource.h>
+#   include <sys/syscall.h>
+#   include <unistd.h>
+#endif
+
+#include <nlohmann/json.hpp>
+
+#include "logging.hpp"
+#include "thread.hpp"
+
+using namespace std;
+using namespace std::experimental;
+
+namespace dsmq {
+
+static Logger logger( "thread" );
+
+void from_json( nlohmann::json const& src, ThreadOptions& dst )
+{
+    dst.name_ = src.value( "name", dst.name_ );
+    dst.cpus_ = src.value( "cpus", dst.cpus_ );
+    if ( src.count( "nice" ) > 0 ) {
+        dst.nice_ = src.at( "nice" ).get< int >();
+    }
+    dst.policy_ = src.value( "policy", dst.policy_ );
+    dst.priority_ = src.value( "priority", dst.priority_ );
+    if ( dst.policy_ != "other" && dst.policy_ != "fifo" && dst.policy_ != "rr" ) {
+        throw invalid_argument( "unknown scheduling policy " + dst.policy_ );
+    }
+#if defined( __linux__ )
+    for ( auto cpu : dst.cpus_ ) {
+        if ( cpu >= CPU_SETSIZE ) {
+            throw invalid_argument( "CPU index " + to_string( cpu ) + " is out of range" );
+        }
+    }
+#endif
+}
+
+#if defined( __linux__ )
+
+static string describeCpus( cpu_set_t const& set )
+{
+    ostringstream os;
+    int first = -1;
+    for ( int cpu = 0; cpu <= CPU_SETSIZE; ++cpu ) {
+        auto contained = cpu < CPU_SETSIZE && CPU_ISSET( cpu, &set );
+        if ( contained && first < 0 ) {
+            first = cpu;
+        } else if ( !contained && first >= 0 ) {
+            os << ( os.tellp() > 0 ? "," : "" ) << first;
+            if ( cpu - 1 > first ) {
+                os << "-" << cpu - 1;
+            }
+            first = -1;
+        }
+    }
+    return os.str();
+}
+
+static char const* describePolicy( int policy )
+{
+    switch ( policy ) {
+        case SCHED_FIFO: return "fifo";
+        case SCHED_RR: return "rr";
+        case SCHED_BATCH: return "batch";
+        case SCHED_IDLE: return "idle";
+        default: return "other";
+    }
+}
+
+void Thread::configure( char const* role, ThreadOptions const& options )
+{
+    auto self = pthread_self();
+    auto tid = static_cast< pid_t >( syscall( SYS_gettid ));
+
+    if ( !options.name().empty() ) {
+        // the kernel keeps 15 characters
+        if ( int rc = pthread_setname_np( self, options.name().substr( 0, 15 ).c_str() )) {
+            logger.warning( "couldn't name ", role, " thread: ", strerror( rc ));
+        }
+    }
+
+    if ( !options.cpus().empty() ) {
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        for ( auto cpu : options.cpus() ) {
+            CPU_SET( cpu, &set );
+        }
+        if ( int rc = pthread_setaffinity_np( self, sizeof( set ), &set )) {
+            logger.warning( "couldn't pin ", role, " thread to CPUs ", describeCpus( set ), ": ", strerror( rc ));
+        }
+    }
+
+    if ( options.policy() != "other" ) {
+        sched_param param {};
+        param.sched_priority = options.priority();
+        auto policy = options.policy() == "fifo" ? SCHED_FIFO : SCHED_RR;
+        if ( int rc = pthread_setschedparam( self, policy, &param )) {
+            logger.warning( "couldn't set ", options.policy(), " scheduling for ", role, " thread: ", strerror( rc ));
+        }
+    }
+
+    // on Linux the nice value is per thread
+    if ( options.nice() && setpriority( PRIO_PROCESS, static_cast< id_t >( tid ), *options.nice() ) != 0 ) {
+        logger.warning( "couldn't set nice value ", *options.nice(), " for ", role, " thread: ", strerror( errno ));
+    }
+
+    char name[ 16 ] {};
+    pthread_getname_np( self, name, sizeof( name ));
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    pthread_getaffinity_np( self, sizeof( set ), &set );
+    int policy {};
+    sched_param param {};
+    pthread_getschedparam( self, &policy, &param );
+    errno = 0;
+    auto nice = getpriority( PRIO_PROCESS, static_cast< id_t >( tid ));
+
+    logger.info( role, " thread ", tid, " (", name, ") on CPUs ", describeCpus( set ), ", policy ", describePolicy( policy ),
+            ", priority ", param.sched_priority, ", nice ", nice );
+}
+
+#else
+
+void Thread::configure( char const* role, ThreadOptions const& options )
+{
+    if ( !options.name().empty() || !options.cpus().empty() || options.nice() || options.policy() != "other" ) {
+        logger.warning( "thread placement for the ", role, " thread isn't supported on this platform" );
+    }
+}
+
+#endif
+
+} // namespace dsmq
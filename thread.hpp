@@ -0,0 +1,47 @@
+#ifndef DS_MQTT_BRIDGE_THREAD_HPP
+#define DS_MQTT_BRIDGE_THREAD_HPP
+
+#include <string>
+#include <vector>
+#include <experimental/optional>
+
+#include <nlohmann/json_fwd.hpp>
+
+namespace dsmq {
+
+class ThreadOptions
+{
+    friend void from_json( nlohmann::json const& src, ThreadOptions& dst );
+
+public:
+    std::string const& name() const { return name_; }
+    std::vector< unsigned > const& cpus() const { return cpus_; }
+    std::experimental::optional< int > const& nice() const { return nice_; }
+    // "other", "fifo" or "rr", the priority only applies to the real-time policies
+    std::string const& policy() const { return policy_; }
+    int priority() const { return priority_; }
+
+private:
+    std::string name_;
+    std::vector< unsigned > cpus_;
+    std::experimental::optional< int > nice_;
+    std::string policy_ { "other" };
+    int priority_ {};
+};
+
+/**
+ * class Thread
+ *
+ * Applies name, CPU set and scheduling options to the calling thread and logs where the thread ended up. Settings the
+ * system refuses (e.g. real-time priority without CAP_SYS_NICE) are logged and skipped.
+ */
+
+class Thread
+{
+public:
+    static void configure( char const* role, ThreadOptions const& options );
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_THREAD_HPP
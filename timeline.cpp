@@ -0,0 +1,44 @@
+#include <chrono>
+
+#include "logging.hpp"
+#include "timeline.hpp"
+
+using namespace std;
+
+namespace dsmq {
+
+static Logger logger( "startup" );
+
+static auto const started = chrono::steady_clock::now();
+
+atomic< bool > StartupTimeline::finished_ {};
+set< string > StartupTimeline::milestones_;
+mutex StartupTimeline::mutex_;
+
+void StartupTimeline::mark( char const* milestone )
+{
+    if ( !finished_.load( memory_order_relaxed )) {
+        record( milestone );
+    }
+}
+
+void StartupTimeline::finish( char const* milestone )
+{
+    if ( !finished_.load( memory_order_relaxed ) && record( milestone )) {
+        finished_ = true;
+    }
+}
+
+bool StartupTimeline::record( char const* milestone )
+{
+    lock_guard< mutex > lock { mutex_ };
+    if ( !milestones_.insert( milestone ).second ) {
+        return false;
+    }
+
+    auto elapsed = chrono::duration_cast< chrono::microseconds >( chrono::steady_clock::now() - started );
+    logger.info( milestone, " after ", elapsed.count() / 1000.0, " ms" );
+    return true;
+}
+
+} // namespace dsmq
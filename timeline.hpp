@@ -0,0 +1,34 @@
+#ifndef DS_MQTT_BRIDGE_TIMELINE_HPP
+#define DS_MQTT_BRIDGE_TIMELINE_HPP
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace dsmq {
+
+/**
+ * class StartupTimeline
+ *
+ * Logs each startup milestone once, with the time elapsed since the process started. Once the final milestone has
+ * been reached, further marks return immediately.
+ */
+
+class StartupTimeline
+{
+public:
+    static void mark( char const* milestone );
+    static void finish( char const* milestone );
+
+private:
+    static bool record( char const* milestone );
+
+    static std::atomic< bool > finished_;
+    static std::set< std::string > milestones_;
+    static std::mutex mutex_;
+};
+
+} // namespace dsmq
+
+#endif //DS_MQTT_BRIDGE_TIMELINE_HPP
@@ -0,0 +1,37 @@
+#ifndef DS_MQTT_BRIDGE_TRACE_HPP
+#define DS_MQTT_BRIDGE_TRACE_HPP
+
+/**
+ * Static tracepoints for perf, bpftrace and friends, provider "dsmqbridge". They are only compiled in with
+ * DSMQ_TRACEPOINTS, and then cost a single nop each until a tracer attaches. String arguments are C strings.
+ *
+ *   dss_request_start( id, op )                 dss_request_end( id, op, error )
+ *   dss_event_receive( name )                   dss_event_decode( name )
+ *   dss_route( zone, group, scene, found )      mqtt_route( zone, group, scene, found )
+ *   dss_echo_suppressed( zone, group, scene )   mqtt_echo_suppressed( zone, group, scene )
+ *   dss_command_held( zone, group, scene )      dss_state( state )
+ *   mqtt_publish( topic, length )               mqtt_receive( topic, length )
+ *   mqtt_queued( topic )                        mqtt_reconnect( rc )
+ *
+ * The .bt scripts in tools/ are samples for bpftrace.
+ */
+
+#if defined( DSMQ_TRACEPOINTS )
+
+#include <sys/sdt.h>
+
+#define DSMQ_TRACE1( name, a1 ) DTRACE_PROBE1( dsmqbridge, name, a1 )
+#define DSMQ_TRACE2( name, a1, a2 ) DTRACE_PROBE2( dsmqbridge, name, a1, a2 )
+#define DSMQ_TRACE3( name, a1, a2, a3 ) DTRACE_PROBE3( dsmqbridge, name, a1, a2, a3 )
+#define DSMQ_TRACE4( name, a1, a2, a3, a4 ) DTRACE_PROBE4( dsmqbridge, name, a1, a2, a3, a4 )
+
+#else
+
+#define DSMQ_TRACE1( name, a1 ) do {} while ( false )
+#define DSMQ_TRACE2( name, a1, a2 ) do {} while ( false )
+#define DSMQ_TRACE3( name, a1, a2, a3 ) do {} while ( false )
+#define DSMQ_TRACE4( name, a1, a2, a3, a4 ) do {} while ( false )
+
+#endif
+
+#endif //DS_MQTT_BRIDGE_TRACE_HPP